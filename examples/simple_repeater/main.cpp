@@ -14,6 +14,10 @@
 #include <helpers/StaticPoolPacketManager.h>
 #include <helpers/TxtDataHelpers.h>
 #include <helpers/CommonCLI.h>
+#include <helpers/PacketLogger.h>
+#include <helpers/RadioRecovery.h>
+#include <helpers/TDMASchedule.h>
+#include <helpers/Fragmenter.h>
 #include <RTClib.h>
 #include <target.h>
 
@@ -53,8 +57,6 @@
 
 #define FIRMWARE_ROLE "kisstnc"
 
-#define PACKET_LOG_FILE  "/packet_log"
-
 #ifdef ENABLE_BLE
   #define BLE_SCAN_TIME_MS (30 * 10000)
   #define BLE_DEVICE_NAME "MeshTNC"
@@ -72,20 +74,30 @@
 
 #define CLI_REPLY_DELAY_MILLIS  600
 
+#ifndef SURVEY_MAX_BINS
+  #define SURVEY_MAX_BINS    64   // per sweep (one KISS frame)
+#endif
+
+#ifndef SCAN_HOLD_SYMBOLS
+  #define SCAN_HOLD_SYMBOLS  32   // after CAD hit, time (in symbols) to wait for preamble/header detect
+#endif
+
 
-class MyMesh : public mesh::Mesh, public CommonCLICallbacks {
+class MyMesh : public mesh::Mesh, public CommonCLICallbacks, public KISSVendorHandler {
 
   FILESYSTEM* _fs;
   CommonCLI _cli;
-  bool _logging;
+  PacketLogger _pkt_log;
+  RadioRecovery _recovery;
+  TDMASchedule _tdma;
+  Fragmenter _frag;
   NodePrefs _prefs;
   uint8_t reply_data[MAX_PACKET_PAYLOAD];
-  unsigned long set_radio_at, revert_radio_at;
-  float pending_freq;
-  float pending_bw;
-  uint8_t pending_sf;
-  uint8_t pending_cr;
-  uint8_t pending_sync_word;
+  unsigned long revert_radio_at;
+  RadioParams active;
+  bool scanning;
+  uint8_t scan_idx;
+  unsigned long scan_hold_until;
 
 #ifdef ENABLE_BLE
   NimBLEScan* bleScan;
@@ -98,26 +110,317 @@ protected:
     return _prefs.airtime_factor;
   }
 
-  void logRxRaw(float snr, float rssi, const uint8_t raw[], int len) override {
+  // back-dates a past micros() timestamp (eg. radio ISR, end of packet) onto the RTC, in epoch millis
+  uint64_t microsToRTCMillis(uint32_t at_micros) {
+    uint64_t now_ms = rtc_clock.getCurrentTimeMillis();
+    if (at_micros == 0) return now_ms;   // radio doesn't latch RX time
+    return now_ms - (uint32_t)(micros() - at_micros) / 1000;
+  }
+
+  void printRxLogStart(const mesh::RxMetadata& meta, uint64_t rx_ms) {
+    Serial.printf("%lu", (unsigned long) (rx_ms / 1000));
+    Serial.printf(",%s,%.2f,%.2f", meta.crc_ok ? "RXLOG" : "RXBAD", meta.rssi, meta.snr);
+    Serial.print(",");
+  }
+  void printRxLogEnd(const mesh::RxMetadata& meta, uint64_t rx_ms) {
+    Serial.printf(",%lu%03u,%lu", (unsigned long) (rx_ms / 1000), (uint32_t) (rx_ms % 1000), (unsigned long) meta.rx_micros);
+    if (scanning) Serial.printf(",%d", (uint32_t) getScanTag());
+    Serial.println();
+  }
+  void printRxLog(const mesh::RxMetadata& meta, uint64_t rx_ms, const uint8_t* data, int len) {
+    printRxLogStart(meta, rx_ms);
+    mesh::Utils::printHex(Serial, data, len);
+    printRxLogEnd(meta, rx_ms);
+  }
+
+  void sendKISSRxMeta(const mesh::RxMetadata& meta, uint64_t rx_ms) {
+    uint8_t meta_buf[KISS_RX_META_LEN];
+    uint8_t kiss_rx[2 + 2*KISS_RX_META_LEN + 1];
+    int16_t rssi_q = (int16_t)(meta.rssi * 4.0f);
+    int8_t snr_q = (int8_t)(meta.snr * 4.0f);
+    int16_t signal_rssi_q = (int16_t)(meta.signal_rssi * 4.0f);
+    int32_t freq_error = (int32_t) meta.freq_error;
+    meta_buf[0] = KISSVendorCmd::RxMeta;
+    memcpy(&meta_buf[1], &rx_ms, 8);
+    memcpy(&meta_buf[9], &meta.rx_micros, 4);
+    memcpy(&meta_buf[13], &rssi_q, 2);
+    meta_buf[15] = (uint8_t) snr_q;
+    memcpy(&meta_buf[16], &signal_rssi_q, 2);
+    memcpy(&meta_buf[18], &freq_error, 4);
+    meta_buf[22] = meta.crc_ok ? KISS_RX_META_FLAG_CRC_OK : 0;
+    meta_buf[23] = getScanTag();
+    uint16_t kiss_rx_len = getCLI()->getKISSModem()->encodeKISSFrame(
+      KISSCmd::Vendor, meta_buf, sizeof(meta_buf), kiss_rx, sizeof(kiss_rx)
+    );
+    Serial.write(kiss_rx, kiss_rx_len);
+  }
+
+  void logRxRaw(const mesh::RxMetadata& meta, const uint8_t raw[], int len) override {
+    float rssi = meta.rssi, snr = meta.snr;
+    uint32_t rx_micros = meta.rx_micros;
+    uint64_t rx_ms = microsToRTCMillis(rx_micros);
+    _pkt_log.logRx(rx_ms, rx_micros, rssi, snr, meta.crc_ok ? 0 : PACKET_LOG_FLAG_CRC_BAD, raw, len);
+
     CLIMode cli_mode = _cli.getCLIMode();
     if (cli_mode == CLIMode::CLI) {
       if (!_prefs.log_rx) return;
-      CommonCLI* cli = getCLI();
-      Serial.printf("%lu", rtc_clock.getCurrentTime());
-      Serial.printf(",RXLOG,%.2f,%.2f", rssi, snr);
-      Serial.print(",");
-      mesh::Utils::printHex(Serial, raw, len);
-      Serial.println();
+
+      // frames as the KISS host would get them
+      int frag_res = meta.crc_ok && _frag.isEnabled() ? _frag.onRecv(raw, len, millis()) : FRAG_RX_RAW;
+      if (frag_res == FRAG_RX_HELD || frag_res == FRAG_RX_DROPPED || frag_res == FRAG_RX_LATE) return;
+
+      if (frag_res == FRAG_RX_AGGREGATE) {   // one line per frame
+        int pos = 0, frame_len;
+        const uint8_t* frame;
+        while ((frame_len = Fragmenter::nextInAggregate(raw, len, pos, frame)) > 0) {
+          printRxLog(meta, rx_ms, frame, frame_len);
+        }
+        return;
+      }
+      if (frag_res == FRAG_RX_COMPLETE) {
+        printRxLogStart(meta, rx_ms);
+        for (int i = 0; i < _frag.getNumChunks(); i++) {
+          int chunk_len;
+          const uint8_t* chunk = _frag.getChunk(i, chunk_len);
+          mesh::Utils::printHex(Serial, chunk, chunk_len);
+        }
+        printRxLogEnd(meta, rx_ms);
+        _frag.releaseComplete();
+        return;
+      }
+      if (frag_res == FRAG_RX_WHOLE) {
+        raw++;   // skip the link-layer header
+        len--;
+      }
+      printRxLog(meta, rx_ms, raw, len);
     } else if (cli_mode == CLIMode::KISS) {
+      if (!meta.crc_ok && !_prefs.kiss_rx_meta) return;   // host can't tell a bad frame without the metadata
+
+      int frag_res = meta.crc_ok && _frag.isEnabled() ? _frag.onRecv(raw, len, millis()) : FRAG_RX_RAW;
+      if (frag_res == FRAG_RX_HELD || frag_res == FRAG_RX_DROPPED || frag_res == FRAG_RX_LATE) return;   // nothing for the host (yet)
+
       uint8_t kiss_rx[CMD_BUF_LEN_MAX];
       KISSModem* kiss = getCLI()->getKISSModem();
-      uint16_t kiss_rx_len = kiss->encodeKISSFrame(
+      uint16_t kiss_rx_len;
+      if (frag_res == FRAG_RX_AGGREGATE) {   // split back into the host frames, each with its own metadata
+        int pos = 0, frame_len;
+        const uint8_t* frame;
+        while ((frame_len = Fragmenter::nextInAggregate(raw, len, pos, frame)) > 0) {
+          if (_prefs.kiss_rx_meta) sendKISSRxMeta(meta, rx_ms);
+          kiss_rx_len = kiss->encodeKISSFrame(
+            KISSCmd::Data, frame, frame_len, kiss_rx, sizeof(kiss_rx)
+          );
+          Serial.write(kiss_rx, kiss_rx_len);
+        }
+        return;
+      }
+      if (_prefs.kiss_rx_meta) sendKISSRxMeta(meta, rx_ms);
+      if (frag_res == FRAG_RX_COMPLETE) {   // too big for kiss_rx, write it out a fragment at a time
+        kiss->writeFrameStart(KISSCmd::Data);
+        for (int i = 0; i < _frag.getNumChunks(); i++) {
+          int chunk_len;
+          const uint8_t* chunk = _frag.getChunk(i, chunk_len);
+          kiss->writeFrameData(chunk, chunk_len);
+        }
+        kiss->writeFrameEnd();
+        _frag.releaseComplete();
+        return;
+      }
+      if (frag_res == FRAG_RX_WHOLE) {
+        raw++;   // skip the link-layer header
+        len--;
+      }
+      kiss_rx_len = kiss->encodeKISSFrame(
         KISSCmd::Data, raw, len, kiss_rx, sizeof(kiss_rx)
       );
       Serial.write(kiss_rx, kiss_rx_len);
+    } else if (cli_mode == CLIMode::PCAP) {
+      LoRaTapInfo info;
+      info.ts_secs = rx_ms / 1000;
+      info.ts_usecs = (rx_ms % 1000) * 1000;
+      info.timestamp_us = rx_micros;
+      info.freq = active.freq;
+      info.bw = active.bw;
+      info.sf = active.sf;   // 0 for FSK
+      info.cr = active.cr;
+      info.sync_word = active.sync_word;
+      info.flags = meta.crc_ok ? LORATAP_FLAG_CRC_OK : LORATAP_FLAG_CRC_BAD;
+      info.datarate = 0;
+      if (active.modem == RADIO_MODEM_FSK) {
+        info.flags |= LORATAP_FLAG_MOD_FSK;
+        info.datarate = (uint16_t)(active.bitrate * 10.0f + 0.5f);   // kbps -> 100 bps units
+      } else {
+        if (active.lora_flags & LORA_FLAG_INVERT_IQ) info.flags |= LORATAP_FLAG_IQ_INVERTED;
+        if (active.lora_flags & LORA_FLAG_IMPLICIT_HDR) info.flags |= LORATAP_FLAG_IMPLICIT_HDR;
+        if (active.lora_flags & LORA_FLAG_NO_CRC) info.flags |= LORATAP_FLAG_NO_CRC;
+      }
+      info.rssi = rssi;
+      info.snr = snr;
+      info.noise_floor = radio_driver.getNoiseFloor();
+      info.tag = getScanTag();
+
+      uint8_t pcap_rx[CMD_BUF_LEN_MAX];
+      uint16_t pcap_rx_len = getCLI()->getPCAPWriter()->encodeLoRaTapRecord(   // 0 (counted) if it doesn't fit
+        info, raw, len, pcap_rx, sizeof(pcap_rx)
+      );
+      Serial.write(pcap_rx, pcap_rx_len);
     }
   }
 
+  // 1-based number of the scan profile packets are currently heard on, 0 if not scanning
+  uint8_t getScanTag() const {
+    return scanning ? scan_idx + 1 : 0;
+  }
+
+  void checkScan() {
+    if (!scanning || isSending()) return;
+    if (!millisHasNowPassed(scan_hold_until) || _radio->isReceiving()) return;   // activity on current profile, keep listening
+
+    // hop to next profile
+    scan_idx = (scan_idx + 1) % _prefs.num_scan_profiles;
+    const ScanProfile& p = _prefs.scan_profiles[scan_idx];
+    setActiveRadioParams(loraParams(p.freq, p.bw, p.sf, p.cr, p.sync_word));
+
+    if (_prefs.num_scan_profiles > 1 && _radio->isChannelBusyCAD()) {
+      float symbol_ms = (float)(1 << p.sf) / p.bw;
+      scan_hold_until = futureMillis((int)(symbol_ms * SCAN_HOLD_SYMBOLS) + 1);
+    }
+  }
+
+  static RadioParams loraParams(float freq, float bw, uint8_t sf, uint8_t cr, uint8_t sync_word) {
+    RadioParams p = { freq, bw, sf, cr, sync_word, RADIO_MODEM_LORA, 0, 0 };
+    return p;
+  }
+  static RadioParams fskParams(float freq, float bitrate, float freq_dev, float rx_bw, uint8_t sync_word) {
+    RadioParams p = { freq, rx_bw, 0, 0, sync_word, RADIO_MODEM_FSK, bitrate, freq_dev };
+    return p;
+  }
+  static void setLoRaOpts(RadioParams& p, uint16_t preamble, uint8_t opts, uint8_t implicit_len) {
+    p.preamble_len = preamble;
+    p.lora_flags = opts;   // LORA_OPT_* are the same bits as LORA_FLAG_*
+    p.implicit_len = implicit_len;
+  }
+  RadioParams prefsRadioParams() const {
+    if (_prefs.modem == MODEM_FSK) {
+      return fskParams(_prefs.freq, _prefs.fsk_bitrate, _prefs.fsk_freq_dev, _prefs.fsk_rx_bw, _prefs.sync_word);
+    }
+    RadioParams p = loraParams(_prefs.freq, _prefs.bw, _prefs.sf, _prefs.cr, _prefs.sync_word);
+    setLoRaOpts(p, _prefs.lora_preamble, _prefs.lora_opts, _prefs.lora_implicit_len);
+    return p;
+  }
+  static RadioParams profileParams(const RadioProfile& prof) {
+    if (prof.modem == MODEM_FSK) {
+      return fskParams(prof.getFreq(), prof.getBitrate(), prof.getFreqDev(), prof.getBW(), prof.sync_word);
+    }
+    RadioParams p = loraParams(prof.getFreq(), prof.getBW(), prof.getSF(), prof.getCR(), prof.sync_word);
+    setLoRaOpts(p, prof.preamble, prof.lora_opts, prof.implicit_len);
+    return p;
+  }
+
+  void setActiveRadioParams(const RadioParams& params) {
+    bool modem_changed = params.modem != active.modem;
+    radio_set_params(params);
+    active = params;
+    if (modem_changed) {
+      radio_set_tx_power(_prefs.tx_power_dbm);   // PA config isn't shared between modems on all chips
+    }
+  }
+
+  // the active params, with a packet's overrides applied
+  RadioParams txParams(const mesh::TxOverrides& ovr) const {
+    RadioParams p = active;
+    if (ovr.flags & TX_OVERRIDE_FREQ) p.freq = ovr.freq;
+    if (ovr.flags & TX_OVERRIDE_SYNC_WORD) p.sync_word = ovr.sync_word;
+    if (p.modem == RADIO_MODEM_LORA) {
+      if (ovr.flags & TX_OVERRIDE_BW) p.bw = ovr.bw;
+      if (ovr.flags & TX_OVERRIDE_SF) p.sf = ovr.sf;
+      if (ovr.flags & TX_OVERRIDE_CR) p.cr = ovr.cr;
+    }
+    return p;
+  }
+
+  uint32_t getEstAirtimeFor(const mesh::Packet* packet) override {
+    if ((packet->tx_ovr.flags & TX_OVERRIDE_AIRTIME) == 0) return _radio->getEstAirtimeFor(packet->payload_len);
+    return radio_driver.getEstAirtimeFor(packet->payload_len, txParams(packet->tx_ovr));
+  }
+
+  bool onBeforePacketTx(const mesh::Packet* packet) override {
+    const mesh::TxOverrides& ovr = packet->tx_ovr;
+    if (ovr.flags == 0) return true;
+
+    RadioParams p = txParams(ovr);
+    radio_set_params(p);   // only the changed params are sent to the radio
+    if (radio_driver.getReconfigError() != RADIOLIB_ERR_NONE) {
+      MESH_DEBUG_PRINTLN("TX overrides rejected: %d", (int32_t) radio_driver.getReconfigError());
+      radio_set_params(active);
+      return false;
+    }
+    if (ovr.flags & TX_OVERRIDE_POWER) radio_set_tx_power(ovr.tx_power);
+    return true;
+  }
+
+  void onAfterPacketTx(const mesh::Packet* packet) override {
+    if (packet->tx_ovr.flags == 0) return;
+
+    radio_set_params(active);   // back to the receive settings
+    if (packet->tx_ovr.flags & TX_OVERRIDE_POWER) radio_set_tx_power(_prefs.tx_power_dbm);
+  }
+
+  void sendTimedTxReport(uint32_t tag, uint8_t status, uint64_t start_ms, int32_t late_micros) {
+    if (_cli.getCLIMode() != CLIMode::KISS) return;
+
+    uint8_t data[18];
+    data[0] = KISSVendorCmd::TimedTx;
+    memcpy(&data[1], &tag, 4);
+    data[5] = status;
+    memcpy(&data[6], &start_ms, 8);
+    memcpy(&data[14], &late_micros, 4);
+
+    uint8_t kiss_buf[sizeof(data)*2 + 4];
+    uint16_t kiss_len = getCLI()->getKISSModem()->encodeKISSFrame(KISSCmd::Vendor, data, sizeof(data), kiss_buf, sizeof(kiss_buf));
+    Serial.write(kiss_buf, kiss_len);
+  }
+
+  void onTimedTx(const mesh::Packet* packet, uint8_t status, uint32_t start_micros, int32_t late_micros) override {
+    uint64_t start_ms = status == TIMED_TX_SENT ? microsToRTCMillis(start_micros) : 0;
+    sendTimedTxReport(packet->host_tag, status, start_ms, late_micros);
+  }
+
+  void onRadioFault(uint16_t err_event) override {
+    switch (_recovery.onFault(err_event, millis())) {
+    case RECOVERY_ACTION_REARM:
+      MESH_DEBUG_PRINTLN("Radio recovery: re-arming Rx (err=%d)", (uint32_t) err_event);
+      radio_driver.rearm();
+      break;
+    case RECOVERY_ACTION_REINIT: {
+      MESH_DEBUG_PRINTLN("Radio recovery: re-initialising radio (err=%d)", (uint32_t) err_event);
+      bool ok = radio_init();
+      _recovery.onReinitResult(ok);
+      if (ok) {
+        radio_driver.onRadioReset();
+        setActiveRadioParams(active);   // sends all params, back into Rx
+        radio_set_tx_power(_prefs.tx_power_dbm);
+      }
+      break;
+    }
+    case RECOVERY_ACTION_REBOOT:
+      MESH_DEBUG_PRINTLN("Radio recovery: rebooting (err=%d)", (uint32_t) err_event);
+      _prefs.recovery_reboots++;
+      savePrefs();   // NOTE: writes now, also flushes any pending 'set' changes
+      _pkt_log.flush();
+      board.reboot();  // doesn't return
+      break;
+    }
+  }
+
+  int getTxSlotRemaining() override {
+    if (!_tdma.isEnabled()) return -1;
+    return _tdma.getTxRemaining(rtc_clock.getCurrentTimeMillis());
+  }
+  uint32_t getTxSlotMax() override {
+    return _tdma.getMaxTxMillis();
+  }
+
   int calcRxDelay(float score, uint32_t air_time) const override {
     if (_prefs.rx_delay_base <= 0.0f) return 0;
     return (int) ((pow(_prefs.rx_delay_base, 0.85f - score) - 1.0) * air_time);
@@ -126,6 +429,12 @@ protected:
   int getInterferenceThreshold() const override {
     return _prefs.interference_threshold;
   }
+  bool useCADForLBT() const override {
+    return _prefs.lbt_mode == LBT_MODE_CAD;
+  }
+  bool useCutThrough() const override {
+    return _prefs.cut_through;
+  }
   int getAGCResetInterval() const override {
     return ((int)_prefs.agc_reset_interval) * 4000;   // milliseconds
   }
@@ -133,10 +442,13 @@ protected:
 
 public:
   MyMesh(mesh::MainBoard& board, mesh::Radio& radio, mesh::MillisecondClock& ms, mesh::RNG& rng, mesh::RTCClock& rtc)
-     : mesh::Mesh(radio, ms, *new StaticPoolPacketManager(32)), _cli(board, rtc, &_prefs, this, this)
+     : mesh::Mesh(radio, ms, *new StaticPoolPacketManager(32)), _cli(board, rtc, &_prefs, this, this), _frag(this)
   {
-    set_radio_at = revert_radio_at = 0;
-    _logging = false;
+    revert_radio_at = 0;
+    memset(&active, 0, sizeof(active));
+    scanning = false;
+    scan_idx = 0;
+    scan_hold_until = 0;
 
 #ifdef ENABLE_BLE
     bleReported = false;
@@ -157,6 +469,17 @@ public:
     _prefs.interference_threshold = 0;  // disabled
     _prefs.sync_word = 0x2B;
     _prefs.log_rx = true;
+    _prefs.log_flash = false;
+    _prefs.kiss_rx_meta = false;
+    _prefs.lbt_mode = LBT_MODE_CAD;
+    _prefs.promiscuous = false;
+    _prefs.radio_recovery = true;
+    _prefs.cut_through = true;
+    _prefs.recovery_reboots = 0;
+    _prefs.modem = MODEM_LORA;
+    _prefs.fsk_bitrate = 50.0f;
+    _prefs.fsk_freq_dev = 25.0f;
+    _prefs.fsk_rx_bw = 156.2f;
     _prefs.ble_enabled = false;
     _prefs.ble_filter_dups = true;
     _prefs.ble_active_scan = false;
@@ -168,9 +491,20 @@ public:
     mesh::Mesh::begin();
     _fs = fs;
     _cli.loadPrefs(_fs);
+    _cli.getKISSModem()->setVendorHandler(this);
+    _cli.getKISSModem()->setFragmenter(&_frag);
+    _pkt_log.begin(_fs);
+    _pkt_log.setEnabled(_prefs.log_flash);
 
-    radio_set_params(_prefs.freq, _prefs.bw, _prefs.sf, _prefs.cr, _prefs.sync_word);
+    setActiveRadioParams(prefsRadioParams());
     radio_set_tx_power(_prefs.tx_power_dbm);
+    radio_driver.setPromiscuous(_prefs.promiscuous);
+    _recovery.setEnabled(_prefs.radio_recovery);
+    _tdma.configure(_prefs.tdma, _prefs.tdma_frame_ms, _prefs.tdma_num_slots, _prefs.tdma_slot_mask, _prefs.tdma_guard_ms);
+    setQoSWeights(_prefs.qos_weights);
+    _frag.setEnabled(_prefs.frag);
+    _frag.setFECRepairs(_prefs.frag_fec_repairs);
+    _frag.setAggHold(_prefs.frag_agg_hold);
 
 #ifdef ENABLE_BLE
     NimBLEDevice::init(std::__cxx11::string(BLE_DEVICE_NAME));
@@ -217,18 +551,262 @@ public:
 
 
   void applyTempRadioParams(float freq, float bw, uint8_t sf, uint8_t cr, uint8_t sync_word, int timeout_mins) {
-    set_radio_at = futureMillis(2000);   // give CLI reply some time to be sent back, before applying temp radio params
-    pending_freq = freq;
-    pending_bw = bw;
-    pending_sf = sf;
-    pending_cr = cr;
-    pending_sync_word = sync_word;
+    scanning = false;
+    setActiveRadioParams(loraParams(freq, bw, sf, cr, sync_word));   // only changed params are applied, RX resumes straight away
+    MESH_DEBUG_PRINTLN("Temp radio params");
 
-    revert_radio_at = futureMillis(2000 + timeout_mins*60*1000);   // schedule when to revert radio params
+    revert_radio_at = futureMillis(timeout_mins*60*1000);   // schedule when to revert radio params
   }
 
   void applyRadioParams(float freq, float bw, uint8_t sf, uint8_t cr, uint8_t sync_word) {
-    radio_set_params(freq, bw, sf, cr, sync_word);
+    scanning = false;
+    RadioParams p = loraParams(freq, bw, sf, cr, sync_word);
+    setLoRaOpts(p, _prefs.lora_preamble, _prefs.lora_opts, _prefs.lora_implicit_len);
+    setActiveRadioParams(p);
+  }
+
+  bool applyPrefsRadio() override {
+    RadioParams prev = active;
+    scanning = false;
+    setActiveRadioParams(prefsRadioParams());
+    if (radio_driver.getReconfigError() != RADIOLIB_ERR_NONE) {
+      MESH_DEBUG_PRINTLN("Radio params rejected: %d", (int32_t) radio_driver.getReconfigError());
+      setActiveRadioParams(prev);
+      return false;
+    }
+    revert_radio_at = 0;
+    return true;
+  }
+
+  bool applyFSKParams(float freq, float bitrate, float freq_dev, float rx_bw, uint8_t sync_word, int timeout_mins) override {
+    RadioParams prev = active;
+    scanning = false;
+    setActiveRadioParams(fskParams(freq, bitrate, freq_dev, rx_bw, sync_word));
+    if (radio_driver.getReconfigError() != RADIOLIB_ERR_NONE) {
+      MESH_DEBUG_PRINTLN("FSK params rejected: %d", (int32_t) radio_driver.getReconfigError());
+      setActiveRadioParams(prev);
+      return false;
+    }
+    revert_radio_at = timeout_mins > 0 ? futureMillis(timeout_mins*60*1000) : 0;
+    return true;
+  }
+
+  void sendRadioResult(uint8_t cmd, int16_t err) {
+    if (_cli.getCLIMode() != CLIMode::KISS) return;   // eg. in PCAP mode, anything else would corrupt the capture
+
+    uint8_t data[3];
+    data[0] = cmd;
+    memcpy(&data[1], &err, 2);
+
+    uint8_t kiss_buf[sizeof(data)*2 + 4];
+    uint16_t kiss_len = getCLI()->getKISSModem()->encodeKISSFrame(KISSCmd::Vendor, data, sizeof(data), kiss_buf, sizeof(kiss_buf));
+    Serial.write(kiss_buf, kiss_len);
+  }
+
+  void sendSurveyResult(float start_freq, float step_khz, int samples, const SurveyBin bins[], int num_bins) {
+    CLIMode cli_mode = _cli.getCLIMode();
+    if (cli_mode == CLIMode::CLI) {
+      Serial.printf("%lu,SURVEY,%s", rtc_clock.getCurrentTime(), StrHelper::ftoa(start_freq));
+      Serial.printf(",%s,%d,", StrHelper::ftoa(step_khz), samples);
+      mesh::Utils::printHex(Serial, (const uint8_t *) bins, num_bins * sizeof(SurveyBin));
+      Serial.println();
+    } else if (cli_mode == CLIMode::KISS) {
+      uint8_t data[11 + SURVEY_MAX_BINS*sizeof(SurveyBin)];
+      uint32_t start_hz = (uint32_t)(start_freq * 1000000.0f + 0.5f);
+      uint32_t step_hz = (uint32_t)(step_khz * 1000.0f + 0.5f);
+      data[0] = KISSVendorCmd::Survey;
+      memcpy(&data[1], &start_hz, 4);
+      memcpy(&data[5], &step_hz, 4);
+      data[9] = samples;
+      data[10] = num_bins;
+      memcpy(&data[11], bins, num_bins * sizeof(SurveyBin));
+
+      uint8_t kiss_buf[sizeof(data)*2 + 4];   // worst case, every byte escaped
+      uint16_t kiss_len = getCLI()->getKISSModem()->encodeKISSFrame(
+        KISSCmd::Vendor, data, 11 + num_bins * sizeof(SurveyBin), kiss_buf, sizeof(kiss_buf)
+      );
+      Serial.write(kiss_buf, kiss_len);
+    }
+  }
+
+  int runSurvey(float start_freq, float stop_freq, float step_khz, int samples) override {
+    if (isSending()) return 0;
+
+    int num_bins = (int)((stop_freq - start_freq) * 1000.0f / step_khz + 0.5f) + 1;
+    if (num_bins > SURVEY_MAX_BINS) num_bins = SURVEY_MAX_BINS;
+    if (samples > SURVEY_MAX_SAMPLES) samples = SURVEY_MAX_SAMPLES;
+
+    SurveyBin bins[SURVEY_MAX_BINS];
+    num_bins = radio_driver.surveyRSSI(start_freq, step_khz / 1000.0f, num_bins, samples, bins);
+    if (num_bins > 0) {
+      sendSurveyResult(start_freq, step_khz, samples, bins, num_bins);
+    }
+    return num_bins;
+  }
+
+  void onKISSVendorCmd(const uint8_t* data, uint16_t len) override {
+    if (data[0] == KISSVendorCmd::Survey && len >= 14) {
+      uint32_t start_hz, stop_hz, step_hz;
+      memcpy(&start_hz, &data[1], 4);
+      memcpy(&stop_hz, &data[5], 4);
+      memcpy(&step_hz, &data[9], 4);
+      if (step_hz > 0 && stop_hz >= start_hz && data[13] > 0) {
+        runSurvey(start_hz / 1000000.0f, stop_hz / 1000000.0f, step_hz / 1000.0f, data[13]);
+      }
+    } else if (data[0] == KISSVendorCmd::SetRadio && len >= 2) {
+      uint32_t freq_hz, bw_hz;
+      RadioParams p;
+      if (data[1] == RADIO_MODEM_LORA && len >= KISS_SET_RADIO_LORA_LEN) {
+        memcpy(&freq_hz, &data[2], 4);
+        memcpy(&bw_hz, &data[6], 4);
+        p = loraParams(freq_hz / 1000000.0f, bw_hz / 1000.0f, data[10], data[11], data[12]);
+        if (len >= KISS_SET_RADIO_LORA_EXT_LEN) {   // optional LoRa options
+          uint16_t preamble;
+          memcpy(&preamble, &data[13], 2);
+          setLoRaOpts(p, preamble, data[15] & LORA_OPT_ALL, data[16]);
+        }
+        int16_t err = RADIOLIB_ERR_NONE;
+        if (p.sf < 5 || p.sf > 12) err = RADIOLIB_ERR_INVALID_SPREADING_FACTOR;
+        else if (p.cr < 5 || p.cr > 8) err = RADIOLIB_ERR_INVALID_CODING_RATE;
+        else if (p.bw < 7.0f || p.bw > 500.0f) err = RADIOLIB_ERR_INVALID_BANDWIDTH;
+        else if (p.preamble_len != 0 && p.preamble_len < LORA_MIN_PREAMBLE) err = RADIOLIB_ERR_INVALID_PREAMBLE_LENGTH;
+        else if ((p.lora_flags & LORA_FLAG_IMPLICIT_HDR) && p.implicit_len == 0) err = RADIOLIB_ERR_UNSUPPORTED;
+        if (err != RADIOLIB_ERR_NONE) {
+          sendRadioResult(KISSVendorCmd::SetRadio, err);
+          return;
+        }
+      } else if (data[1] == RADIO_MODEM_FSK && len >= KISS_SET_RADIO_FSK_LEN) {
+        uint32_t bitrate_bps, freq_dev_hz;
+        memcpy(&freq_hz, &data[2], 4);
+        memcpy(&bw_hz, &data[6], 4);
+        memcpy(&bitrate_bps, &data[10], 4);
+        memcpy(&freq_dev_hz, &data[14], 4);
+        p = fskParams(freq_hz / 1000000.0f, bitrate_bps / 1000.0f, freq_dev_hz / 1000.0f, bw_hz / 1000.0f, data[18]);
+        if (p.bitrate < FSK_MIN_BITRATE || p.bitrate > FSK_MAX_BITRATE) {
+          sendRadioResult(KISSVendorCmd::SetRadio, RADIOLIB_ERR_INVALID_BIT_RATE);
+          return;
+        }
+      } else {
+        sendRadioResult(KISSVendorCmd::SetRadio, RADIOLIB_ERR_UNSUPPORTED);
+        return;
+      }
+      if (p.freq < 300.0f || p.freq > 2500.0f) {
+        sendRadioResult(KISSVendorCmd::SetRadio, RADIOLIB_ERR_INVALID_FREQUENCY);
+        return;
+      }
+
+      sendRadioResult(KISSVendorCmd::SetRadio, applyHostRadioParams(p));
+    } else if (data[0] == KISSVendorCmd::TimedTx && len > KISS_TIMED_TX_HDR_LEN) {
+      uint64_t at_ms;
+      uint32_t tag;
+      memcpy(&at_ms, &data[1], 8);
+      memcpy(&tag, &data[9], 4);
+
+      int64_t ahead_ms = (int64_t)(at_ms - rtc_clock.getCurrentTimeMillis());
+      uint16_t frame_len = len - KISS_TIMED_TX_HDR_LEN;
+      mesh::Packet* pkt = ahead_ms <= TIMED_TX_MAX_AHEAD_MILLIS && frame_len <= MAX_PACKET_PAYLOAD ? obtainNewPacket() : NULL;
+      if (pkt == NULL) {
+        sendTimedTxReport(tag, TIMED_TX_REJECTED, 0, 0);
+        return;
+      }
+      if (!_frag.readFrame(pkt, &data[KISS_TIMED_TX_HDR_LEN], frame_len)) {
+        releasePacket(pkt);
+        sendTimedTxReport(tag, TIMED_TX_REJECTED, 0, 0);
+        return;
+      }
+      pkt->host_tag = tag;
+      if (ahead_ms < -1000) ahead_ms = -1000;   // already missed, keep within micros() range
+      if (!sendPacketAt(pkt, micros() + (int32_t)(ahead_ms * 1000))) {
+        sendTimedTxReport(tag, TIMED_TX_REJECTED, 0, 0);
+      }
+    } else if (data[0] == KISSVendorCmd::Queue && len >= 2) {
+      if (data[1] == KISS_QUEUE_LIST) {
+        sendQueueReply(data[1], 0);
+      } else if (data[1] == KISS_QUEUE_CANCEL_ID && len >= 4) {
+        uint16_t id;
+        memcpy(&id, &data[2], 2);
+        sendQueueReply(data[1], cancelQueued(id));
+      } else if (data[1] == KISS_QUEUE_CANCEL_TAG && len >= 6) {
+        uint32_t tag;
+        memcpy(&tag, &data[2], 4);
+        sendQueueReply(data[1], cancelQueuedByTag(tag));
+      }
+    } else if (data[0] == KISSVendorCmd::TxOverride && len > KISS_TX_OVERRIDE_HDR_LEN
+               && len - KISS_TX_OVERRIDE_HDR_LEN <= MAX_PACKET_PAYLOAD) {
+      // [0x05][flags][freq Hz uint32][bw Hz uint32][sf][cr][tx power][sync word][data...]
+      mesh::TxOverrides ovr;
+      uint32_t freq_hz, bw_hz;
+      ovr.flags = data[1];
+      memcpy(&freq_hz, &data[2], 4);
+      memcpy(&bw_hz, &data[6], 4);
+      ovr.freq = freq_hz / 1000000.0f;
+      ovr.bw = bw_hz / 1000.0f;
+      ovr.sf = data[10];
+      ovr.cr = data[11];
+      ovr.tx_power = data[12];
+      ovr.sync_word = data[13];
+
+      if (((ovr.flags & TX_OVERRIDE_FREQ) && (ovr.freq < 300.0f || ovr.freq > 2500.0f)) ||
+          ((ovr.flags & TX_OVERRIDE_BW) && (ovr.bw < 7.0f || ovr.bw > 500.0f)) ||
+          ((ovr.flags & TX_OVERRIDE_SF) && (ovr.sf < 5 || ovr.sf > 12)) ||
+          ((ovr.flags & TX_OVERRIDE_CR) && (ovr.cr < 5 || ovr.cr > 8)) ||
+          ((ovr.flags & TX_OVERRIDE_POWER) && (ovr.tx_power < 1 || ovr.tx_power > 30))) {
+        MESH_DEBUG_PRINTLN("KISS: invalid TX overrides, frame dropped");
+        return;
+      }
+      _cli.getKISSModem()->queueFrame(&data[KISS_TX_OVERRIDE_HDR_LEN], len - KISS_TX_OVERRIDE_HDR_LEN, ovr);
+    } else if (data[0] == KISSVendorCmd::ClassTx && len > KISS_CLASS_TX_HDR_LEN) {
+      // [0x08][class][data...]
+      if (data[1] >= MAX_TX_CLASSES) {
+        MESH_DEBUG_PRINTLN("KISS: invalid traffic class, frame dropped");
+        return;
+      }
+      _cli.getKISSModem()->queueFrame(&data[KISS_CLASS_TX_HDR_LEN], len - KISS_CLASS_TX_HDR_LEN, data[1]);
+    } else if (data[0] == KISSVendorCmd::HostTag && len >= KISS_HOST_TAG_LEN) {
+      uint32_t tag;
+      memcpy(&tag, &data[1], 4);
+      _cli.getKISSModem()->setHostTag(tag);
+    } else if (data[0] == KISSVendorCmd::QoS) {
+      sendQoSReply();
+    } else if (data[0] == KISSVendorCmd::UseProfile && len >= 2) {
+      char name[RADIO_PROFILE_NAME_LEN];
+      int name_len = len - 1 < sizeof(name) - 1 ? len - 1 : sizeof(name) - 1;
+      memcpy(name, &data[1], name_len);
+      name[name_len] = 0;
+      int idx = _cli.findRadioProfile(name);
+      if (idx < 0) {
+        sendRadioResult(KISSVendorCmd::UseProfile, RADIOLIB_ERR_UNKNOWN);
+      } else {
+        sendRadioResult(KISSVendorCmd::UseProfile, applyHostRadioParams(profileParams(_prefs.radio_profiles[idx])));
+      }
+    }
+  }
+
+  // radio params from the KISS host, not persisted. Returns the RadioLib error (previous params restored on error)
+  int16_t applyHostRadioParams(const RadioParams& p) {
+    RadioParams prev = active;
+    scanning = false;
+    revert_radio_at = 0;
+    setActiveRadioParams(p);
+    int16_t err = radio_driver.getReconfigError();
+    if (err != RADIOLIB_ERR_NONE) setActiveRadioParams(prev);
+    return err;
+  }
+
+  bool startScan() override {
+    if (_prefs.num_scan_profiles == 0) return false;
+
+    revert_radio_at = 0;   // scanner takes over from any tempradio
+    scanning = true;
+    scan_idx = _prefs.num_scan_profiles - 1;   // first hop is to profile 1
+    scan_hold_until = 0;
+    return true;
+  }
+
+  void stopScan() override {
+    if (!scanning) return;
+    scanning = false;
+    setActiveRadioParams(prefsRadioParams());
   }
 
 
@@ -305,26 +883,14 @@ public:
 #endif
   }
 
-  void setLoggingOn(bool enable) { _logging = enable; }
+  void setLoggingOn(bool enable) { _pkt_log.setEnabled(enable); }
 
   void eraseLogFile() override {
-    _fs->remove(PACKET_LOG_FILE);
+    _pkt_log.erase();
   }
 
-  void dumpLogFile() override {
-#if defined(RP2040_PLATFORM)
-    File f = _fs->open(PACKET_LOG_FILE, "r");
-#else
-    File f = _fs->open(PACKET_LOG_FILE);
-#endif
-    if (f) {
-      while (f.available()) {
-        int c = f.read();
-        if (c < 0) break;
-        Serial.print((char)c);
-      }
-      f.close();
-    }
+  void dumpLogFile(bool binary) override {
+    _pkt_log.dump(Serial, binary);
   }
 
 
@@ -334,7 +900,169 @@ public:
 
   void clearStats() {
     radio_driver.resetStats();
+    _recovery.resetStats();
+    _frag.resetStats();
     resetStats();
+    _mgr->resetClassStats();
+    getCLI()->getPCAPWriter()->resetStats();
+  }
+
+  void dumpQueue() override {
+    uint8_t priority;
+    int32_t due_millis;
+    const mesh::Packet* pkt;
+    for (int i = 0; (pkt = getQueued(i, priority, due_millis)) != NULL; i++) {
+      Serial.printf("%d,QUEUE,", (uint32_t) pkt->queue_id);
+      if (priority == QUEUED_PRIORITY_TIMED) Serial.print("T");
+      else Serial.printf("%d", (uint32_t) priority);
+      Serial.printf(",%d,%d,%u,%u\n", due_millis, (uint32_t) pkt->payload_len,
+        (uint32_t) (millis() - pkt->queued_at), pkt->host_tag);
+    }
+  }
+
+  // [0x07][op][count] + KISS_QUEUE_ENTRY_LEN per entry (list), or [0x07][op][cancelled]
+  void sendQueueReply(uint8_t op, int cancelled) {
+    if (_cli.getCLIMode() != CLIMode::KISS) return;   // eg. in PCAP mode, anything else would corrupt the capture
+
+    uint8_t data[3 + KISS_QUEUE_MAX_ENTRIES*KISS_QUEUE_ENTRY_LEN];
+    data[0] = KISSVendorCmd::Queue;
+    data[1] = op;
+    int len = 3, count = cancelled;
+    if (op == KISS_QUEUE_LIST) {
+      int n = 0;
+      uint8_t priority;
+      int32_t due_millis;
+      const mesh::Packet* pkt;
+      for (; n < KISS_QUEUE_MAX_ENTRIES && (pkt = getQueued(n, priority, due_millis)) != NULL; n++) {
+        uint32_t age_millis = millis() - pkt->queued_at;
+        uint8_t* dp = &data[len];
+        memcpy(&dp[0], &pkt->queue_id, 2);
+        dp[2] = priority;
+        memcpy(&dp[3], &due_millis, 4);
+        dp[7] = pkt->payload_len;
+        memcpy(&dp[8], &age_millis, 4);
+        memcpy(&dp[12], &pkt->host_tag, 4);
+        len += KISS_QUEUE_ENTRY_LEN;
+      }
+      count = n;
+    }
+    data[2] = count;
+
+    uint8_t kiss_buf[sizeof(data)*2 + 4];
+    uint16_t kiss_len = getCLI()->getKISSModem()->encodeKISSFrame(KISSCmd::Vendor, data, len, kiss_buf, sizeof(kiss_buf));
+    Serial.write(kiss_buf, kiss_len);
+  }
+
+  // [0x09][classes] + per class: [weight][queued uint16][sent uint32][airtime ms uint32]
+  void sendQoSReply() {
+    if (_cli.getCLIMode() != CLIMode::KISS) return;   // eg. in PCAP mode, anything else would corrupt the capture
+
+    uint8_t data[2 + MAX_TX_CLASSES*KISS_QOS_ENTRY_LEN];
+    data[0] = KISSVendorCmd::QoS;
+    int len = 2, n = 0;
+    mesh::TxClassStats stats;
+    for (; n < MAX_TX_CLASSES && _mgr->getClassStats(n, stats); n++) {
+      uint8_t* dp = &data[len];
+      dp[0] = stats.weight;
+      memcpy(&dp[1], &stats.queued, 2);
+      memcpy(&dp[3], &stats.n_sent, 4);
+      memcpy(&dp[7], &stats.airtime, 4);
+      len += KISS_QOS_ENTRY_LEN;
+    }
+    data[1] = n;
+
+    uint8_t kiss_buf[sizeof(data)*2 + 4];
+    uint16_t kiss_len = getCLI()->getKISSModem()->encodeKISSFrame(KISSCmd::Vendor, data, len, kiss_buf, sizeof(kiss_buf));
+    Serial.write(kiss_buf, kiss_len);
+  }
+
+  void dumpNoiseStats() override {
+    const NoiseFloorEstimator& noise = radio_driver.getNoiseEstimator();
+    for (int i = 0; i < noise.getNumChannels(); i++) {
+      const NoiseChannel& ch = noise.getChannel(i);
+      if (ch.freq == 0) continue;   // unused slot
+
+      Serial.printf("%s,NOISE", StrHelper::ftoa(ch.freq));
+      Serial.printf(",%d,%d,%d,%u,",
+        NoiseFloorEstimator::getQuantile(ch, 10), NoiseFloorEstimator::getQuantile(ch, 50), NoiseFloorEstimator::getQuantile(ch, 90),
+        ch.num_samples);
+      for (int j = 0; j < ch.history_len; j++) {   // oldest first
+        int idx = (ch.history_next + NOISE_HISTORY_LEN - ch.history_len + j) % NOISE_HISTORY_LEN;
+        Serial.printf("%s%d", j > 0 ? " " : "", (int) ch.history[idx]);
+      }
+      Serial.println();
+    }
+  }
+
+  void formatStatsReply(char* reply) override {
+    sprintf(reply, "> rx:%u,tx:%u,airtime:%u,turnaround_us:%u,max_turnaround_us:%u,reconfig_us:%u,preambles:%u,headers:%u,crc_errors:%u,cut_through:%u,cut_through_us:%u,queued_us:%u,pcap_dropped:%u",
+      radio_driver.getPacketsRecv(), radio_driver.getPacketsSent(),
+      (uint32_t) (getTotalAirTime() / 1000),
+      _radio->getTxTurnaroundMicros(), _radio->getMaxTxTurnaroundMicros(),
+      _radio->getReconfigMicros(),
+      radio_driver.getPreambleCount(), radio_driver.getHeaderCount(), radio_driver.getCRCErrorCount(),
+      getNumCutThrough(), getCutThroughLatency(), getQueuedLatency(), getCLI()->getPCAPWriter()->getNumDropped());
+  }
+
+  void setPromiscuous(bool enable) override {
+    radio_driver.setPromiscuous(enable);
+  }
+
+  void setRadioRecovery(bool enable) override {
+    _recovery.setEnabled(enable);
+    _recovery.reset();
+  }
+
+  void setTDMA(bool enable, uint32_t frame_ms, uint8_t num_slots, uint32_t slot_mask, uint16_t guard_ms) override {
+    _tdma.configure(enable, frame_ms, num_slots, slot_mask, guard_ms);
+  }
+
+  void setQoSWeights(const uint8_t weights[]) override {
+    for (int c = 0; c < MAX_TX_CLASSES; c++) {
+      _mgr->setClassWeight(c, weights[c]);
+    }
+  }
+
+  void formatQoSReply(char* reply) override {
+    char* dp = reply;
+    dp += sprintf(dp, ">");
+    mesh::TxClassStats stats;
+    for (int c = 0; c < MAX_TX_CLASSES && _mgr->getClassStats(c, stats); c++) {
+      dp += sprintf(dp, " %d:weight:%d,queued:%d,sent:%u,airtime_ms:%u", c, (uint32_t) stats.weight,
+        (uint32_t) stats.queued, stats.n_sent, stats.airtime);
+    }
+  }
+
+  void setFragmentation(bool enable) override {
+    _frag.setEnabled(enable);
+  }
+
+  void setFragFEC(uint8_t repairs) override {
+    _frag.setFECRepairs(repairs);
+  }
+
+  void setFragAggregation(uint16_t hold_millis) override {
+    _frag.setAggHold(hold_millis);
+  }
+  void formatFragReply(char* reply) override {
+    sprintf(reply, "> %s,fec:%d,tx:%u,rx:%u,recovered:%u,timeouts:%u,dropped:%u,agg:%d,agg_frames:%u,agg_packets:%u",
+      _frag.isEnabled() ? "on" : "off",
+      (uint32_t) _frag.getFECRepairs(), _frag.getNumTxFrames(), _frag.getNumRxFrames(), _frag.getNumRxRecovered(),
+      _frag.getNumRxTimeouts(), _frag.getNumRxDropped(),
+      (uint32_t) _frag.getAggHold(), _frag.getNumAggFrames(), _frag.getNumAggPackets());
+  }
+
+  void formatRecoveryReply(char* reply) override {
+    const char* last = "none";
+    uint32_t ago_secs = 0;
+    if (_recovery.getNumFaults() > 0) {
+      last = _recovery.getLastError() == ERR_EVENT_CAD_TIMEOUT ? "cad" : "startrx";
+      ago_secs = (millis() - _recovery.getLastFaultTime()) / 1000;
+    }
+    sprintf(reply, "> %s,level:%d,faults:%u,rearms:%u,reinits:%u,reinit_fails:%u,reboots:%u,last_fault:%s,ago_secs:%u",
+      _recovery.isEnabled() ? "on" : "off", (uint32_t) _recovery.getLevel(),
+      _recovery.getNumFaults(), _recovery.getNumRearms(), _recovery.getNumReinits(), _recovery.getNumReinitFails(),
+      _prefs.recovery_reboots, last, ago_secs);
   }
 
   void handleSerialData() {
@@ -343,16 +1071,16 @@ public:
 
   void loop() {
     mesh::Dispatcher::loop();
-
-    if (set_radio_at && millisHasNowPassed(set_radio_at)) {   // apply pending (temporary) radio params
-      set_radio_at = 0;  // clear timer
-      radio_set_params(pending_freq, pending_bw, pending_sf, pending_cr, pending_sync_word);
-      MESH_DEBUG_PRINTLN("Temp radio params");
-    }
+    _cli.loop();
+    _pkt_log.loop();
+    _recovery.loop(millis());
+    _frag.setFragAirtime(radio_driver.getEstAirtimeFor(MAX_TRANS_UNIT) * (1.0f + _prefs.airtime_factor));
+    _frag.loop(millis());
+    checkScan();
 
     if (revert_radio_at && millisHasNowPassed(revert_radio_at)) {   // revert radio params to orig
       revert_radio_at = 0;  // clear timer
-      radio_set_params(_prefs.freq, _prefs.bw, _prefs.sf, _prefs.cr, _prefs.sync_word);
+      setActiveRadioParams(prefsRadioParams());
       MESH_DEBUG_PRINTLN("Radio params restored");
     }
 
@@ -401,4 +1129,5 @@ void loop() {
   if (Serial.available())
     the_mesh.handleSerialData();
   the_mesh.loop();
+  rtc_clock.tick();
 }
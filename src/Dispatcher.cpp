@@ -17,6 +17,8 @@ namespace mesh {
 void Dispatcher::begin() {
   n_sent_flood = n_sent_direct = 0;
   n_recv_flood = n_recv_direct = 0;
+  n_cut_through = n_queued_now = 0;
+  cut_through_micros = queued_now_micros = 0;
   _err_flags = 0;
   radio_nonrx_start = _ms->getMillis();
 
@@ -54,8 +56,15 @@ void Dispatcher::loop() {
       radio_nonrx_start = _ms->getMillis();
     }
   }
-  if (!is_recv && _ms->getMillis() - radio_nonrx_start > 8000) {   // radio has not been in Rx mode for 8 seconds!
+  if (!is_recv && _ms->getMillis() - radio_nonrx_start > getStartRxTimeout()) {   // radio has not been in Rx mode for 8 seconds!
     _err_flags |= ERR_EVENT_STARTRX_TIMEOUT;
+
+    if (outbound == NULL) {   // (a long transmit is handled by outbound_expiry)
+      MESH_DEBUG_PRINTLN("%s Dispatcher::loop(): radio stuck outside Rx mode!", getLogDateTime());
+      radio_nonrx_start = _ms->getMillis();   // fault again if still stuck after another timeout
+      onRadioFault(ERR_EVENT_STARTRX_TIMEOUT);
+      prev_isrecv_mode = _radio->isInRecvMode();
+    }
   }
 
   if (outbound) {  // waiting for outbound send to be completed
@@ -67,7 +76,9 @@ void Dispatcher::loop() {
       // will need radio silence up to next_tx_time
       next_tx_time = futureMillis(t * getAirtimeBudgetFactor());
 
-      _radio->onSendFinished();
+      _radio->onSendFinished(outbound->tx_ovr.flags == 0);   // (with tx_ovr, Rx is re-armed once back on the receive settings)
+      onAfterPacketTx(outbound);
+      if (!outbound_timed) _mgr->onPacketSent(outbound, t);   // (timed sends never went through its queue)
       logTx(outbound, 2 + outbound->payload_len);
       n_sent_direct++;
 
@@ -76,7 +87,8 @@ void Dispatcher::loop() {
     } else if (millisHasNowPassed(outbound_expiry)) {
       MESH_DEBUG_PRINTLN("%s Dispatcher::loop(): WARNING: outbound packed send timed out!", getLogDateTime());
 
-      _radio->onSendFinished();
+      _radio->onSendFinished(outbound->tx_ovr.flags == 0);
+      onAfterPacketTx(outbound);
       logTxFail(outbound, 2 + outbound->payload_len);
 
       releasePacket(outbound);  // return to pool
@@ -102,6 +114,7 @@ void Dispatcher::loop() {
     }
   }
   checkRecv();
+  checkTimedSend();
   checkSend();
 }
 
@@ -113,10 +126,14 @@ void Dispatcher::checkRecv() {
     uint8_t raw[MAX_TRANS_UNIT+1];
     int len = _radio->recvRaw(raw, MAX_TRANS_UNIT);
     if (len > 0) {
-      logRxRaw(_radio->getLastSNR(), _radio->getLastRSSI(), raw, len);
-
-      pkt = _mgr->allocNew();
-      if (pkt == NULL) {
+      RxMetadata meta;
+      _radio->getLastRxMeta(meta);
+      meta.len = len;
+      logRxRaw(meta, raw, len);
+
+      if (!meta.crc_ok) {
+        pkt = NULL;   // promiscuous capture, only for logRxRaw()
+      } else if ((pkt = _mgr->allocNew()) == NULL) {
         MESH_DEBUG_PRINTLN("%s Dispatcher::checkRecv(): WARNING: received data, no unused packets available!", getLogDateTime());
       } else {
         pkt->payload_len = len;
@@ -127,8 +144,12 @@ void Dispatcher::checkRecv() {
         } else {
           memcpy(pkt->payload, &raw, pkt->payload_len);
 
-          pkt->_snr = _radio->getLastSNR() * 4.0f;
-          score = _radio->packetScore(_radio->getLastSNR(), len);
+          pkt->_snr = meta.snr * 4.0f;
+          pkt->rx_meta = meta;
+          pkt->tx_ovr.flags = 0;   // a retransmit goes out with the current settings
+          pkt->host_tag = 0;
+          pkt->tx_class = 0;
+          score = _radio->packetScore(meta.snr, len);
           air_time = _radio->getEstAirtimeFor(len);
         }
       }
@@ -141,7 +162,7 @@ void Dispatcher::checkRecv() {
     Serial.print(getLogDateTime());
     Serial.printf(": RX, len=%d payload_len=%d SNR=%d RSSI=%d score=%d", 
             pkt->getRawLength(), pkt->payload_len,
-            (int)pkt->getSNR(), (int)_radio->getLastRSSI(), (int)(score*1000));
+            (int)pkt->getSNR(), (int)pkt->rx_meta.rssi, (int)(score*1000));
     Serial.printf("\n");
     #endif
     logRx(pkt, pkt->getRawLength(), score);   // hook for custom logging
@@ -162,14 +183,73 @@ void Dispatcher::processRecvPacket(Packet* pkt) {
     uint8_t priority = (action >> 24) - 1;
     uint32_t _delay = action & 0xFFFFFF;
 
+    stampQueued(pkt);
     _mgr->queueOutbound(pkt, priority, futureMillis(_delay));
   }
 }
 
+// longest payload that fits in the given airtime (estimate is monotonic in length)
+int Dispatcher::maxLenForAirtime(uint32_t air_ms) {
+  int lo = 0, hi = MAX_TRANS_UNIT;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (_radio->getEstAirtimeFor(mid) <= air_ms) lo = mid; else hi = mid - 1;
+  }
+  return lo;
+}
+
+// next packet that fits in what's left of the TDMA slot, allowing for any SF/BW/CR tx_ovr
+Packet* Dispatcher::getNextForSlot(int slot_left) {
+  int max_len = maxLenForAirtime(slot_left);   // with the active params
+  Packet* pkt;
+  while ((pkt = _mgr->getNextOutbound(_ms->getMillis(), max_len)) != NULL && (pkt->tx_ovr.flags & TX_OVERRIDE_AIRTIME)) {
+    uint32_t air_ms = getEstAirtimeFor(pkt);
+    if (air_ms <= (uint32_t) slot_left) break;
+
+    if (air_ms > getTxSlotMax()) {   // would never fit
+      MESH_DEBUG_PRINTLN("%s Dispatcher::checkSend(): ERROR: packet too long for a TDMA slot, airtime=%d", getLogDateTime(), air_ms);
+      logTxFail(pkt, pkt->getRawLength());
+      releasePacket(pkt);
+    } else {
+      _mgr->returnOutbound(pkt);   // wait for a later slot, meanwhile look for a shorter one
+      max_len = pkt->payload_len - 1;
+    }
+  }
+  if (pkt == NULL) dropTooLongForSlot();   // nothing fits now, don't let any that never will hold up the queue
+  return pkt;
+}
+
+// drops queued packets too long for even this node's longest run of TDMA slots
+void Dispatcher::dropTooLongForSlot() {
+  uint32_t slot_max = getTxSlotMax();
+  for (int i = _mgr->getOutboundTotal() - 1; i >= 0; i--) {   // backwards, as removing shifts the rest down
+    Packet* pkt = _mgr->getOutboundByIdx(i);
+    uint32_t air_ms = getEstAirtimeFor(pkt);
+    if (air_ms <= slot_max) continue;
+
+    MESH_DEBUG_PRINTLN("%s Dispatcher::checkSend(): ERROR: packet too long for a TDMA slot, airtime=%d", getLogDateTime(), air_ms);
+    logTxFail(pkt, pkt->getRawLength());
+    releasePacket(_mgr->removeOutboundByIdx(i));
+  }
+}
+
 void Dispatcher::checkSend() {
   if (_mgr->getOutboundCount(_ms->getMillis()) == 0) return;  // nothing waiting to send
+  if (num_timed > 0) {   // keep the air clear for the next timed send
+    uint32_t guard = _radio->getEstAirtimeFor(MAX_TRANS_UNIT) * 1000 + TIMED_TX_LEAD_MICROS;
+    if ((int32_t)(timed_at[nextTimedIdx()] - _ms->getMicros()) < (int32_t) guard) return;
+  }
+
+  int slot_left = getTxSlotRemaining();
+  if (slot_left >= 0) {   // TDMA, the slot is ours so no LBT
+    if (slot_left == 0) return;
+    outbound = getNextForSlot(slot_left);
+    if (outbound) startOutbound(false, false);
+    return;
+  }
+
   if (!millisHasNowPassed(next_tx_time)) return;   // still in 'radio silence' phase (from airtime budget setting)
-  if (_radio->isReceiving()) {   // LBT - check if radio is currently mid-receive, or if channel activity
+  if (isChannelBusy()) {
     if (cad_busy_start == 0) {
       cad_busy_start = _ms->getMillis();   // record when CAD busy state started
     }
@@ -178,7 +258,10 @@ void Dispatcher::checkSend() {
       _err_flags |= ERR_EVENT_CAD_TIMEOUT;
 
       MESH_DEBUG_PRINTLN("%s Dispatcher::checkSend(): CAD busy max duration reached!", getLogDateTime());
-      // channel activity has gone on too long... (Radio might be in a bad state)
+      // channel activity has gone on too long... only a fault if the radio also looks unwell
+      if (!_radio->isInRecvMode() || (useCADForLBT() && _radio->isCADFaulty())) {
+        onRadioFault(ERR_EVENT_CAD_TIMEOUT);
+      }
       // force the pending transmit below...
     } else {
       next_tx_time = futureMillis(getCADFailRetryDelay());
@@ -188,38 +271,188 @@ void Dispatcher::checkSend() {
   cad_busy_start = 0;  // reset busy state
 
   outbound = _mgr->getNextOutbound(_ms->getMillis());
-  if (outbound) {
-    int len = 0;
-    uint8_t raw[MAX_TRANS_UNIT];
+  if (outbound && !startOutbound(false, true)) {   // busy where its tx_ovr sends it, try again later
+    _mgr->returnOutbound(outbound);
+    outbound = NULL;
+    next_tx_time = futureMillis(getCADFailRetryDelay());
+  }
+}
+
+// LBT - check if radio is currently mid-receive, or if channel activity, on the radio's current settings
+bool Dispatcher::isChannelBusy() {
+  if (_radio->isReceiving()) return true;
+  return useCADForLBT() && _radio->isChannelBusyCAD();   // catches LoRa preambles below the noise floor
+}
+
+// returns false only when 'lbt' and the channel the packet's tx_ovr moves to is busy. The receive
+// settings are then restored, and 'outbound' is left for the caller to put back.
+bool Dispatcher::startOutbound(bool cut_through, bool lbt) {
+  outbound_timed = false;
+  int len = 0;
+  uint8_t raw[MAX_TRANS_UNIT];
+
+  if (len + outbound->payload_len > MAX_TRANS_UNIT) {
+    MESH_DEBUG_PRINTLN("%s Dispatcher::checkSend(): FATAL: Invalid packet queued... too long, len=%d", getLogDateTime(), len + outbound->payload_len);
+    _mgr->free(outbound);
+    outbound = NULL;
+  } else {
+    memcpy(&raw[len], outbound->payload, outbound->payload_len); len += outbound->payload_len;
 
-    if (len + outbound->payload_len > MAX_TRANS_UNIT) {
-      MESH_DEBUG_PRINTLN("%s Dispatcher::checkSend(): FATAL: Invalid packet queued... too long, len=%d", getLogDateTime(), len + outbound->payload_len);
-      _mgr->free(outbound);
+    if (!onBeforePacketTx(outbound)) {
+      MESH_DEBUG_PRINTLN("%s Dispatcher::checkSend(): ERROR: packet TX settings rejected", getLogDateTime());
+      logTxFail(outbound, outbound->getRawLength());
+      releasePacket(outbound);  // return to pool
       outbound = NULL;
-    } else {
-      memcpy(&raw[len], outbound->payload, outbound->payload_len); len += outbound->payload_len;
-
-      uint32_t max_airtime = _radio->getEstAirtimeFor(len)*3/2;
-      outbound_start = _ms->getMillis();
-      bool success = _radio->startSendRaw(raw, len);
-      if (!success) {
-        MESH_DEBUG_PRINTLN("%s Dispatcher::loop(): ERROR: send start failed!", getLogDateTime());
-
-        logTxFail(outbound, outbound->getRawLength());
-  
-        releasePacket(outbound);  // return to pool
-        outbound = NULL;
-        return;
+      return true;
+    }
+    if (lbt && (outbound->tx_ovr.flags & TX_OVERRIDE_CHANNEL) && isChannelBusy()) {   // LBT so far was on the receive channel
+      onAfterPacketTx(outbound);
+      return false;
+    }
+
+    uint32_t max_airtime = _radio->getEstAirtimeFor(len)*3/2;   // (with any tx_ovr now applied)
+    if (outbound->queued_micros != 0) {
+      uint32_t latency = _ms->getMicros() - outbound->queued_micros;
+      if (cut_through) {
+        n_cut_through++;
+        cut_through_micros += latency;
+      } else {
+        n_queued_now++;
+        queued_now_micros += latency;
       }
-      outbound_expiry = futureMillis(max_airtime);
+    }
+    outbound_start = _ms->getMillis();
+    bool success = _radio->startSendRaw(raw, len);
+    if (!success) {
+      MESH_DEBUG_PRINTLN("%s Dispatcher::loop(): ERROR: send start failed!", getLogDateTime());
+      onAfterPacketTx(outbound);
 
-    #if MESH_PACKET_LOGGING
-      Serial.print(getLogDateTime());
-      Serial.printf(": TX, len=%d payload_len=%d", len, outbound->payload_len);
-      Serial.printf("\n");
-    #endif
+      logTxFail(outbound, outbound->getRawLength());
+
+      releasePacket(outbound);  // return to pool
+      outbound = NULL;
+      return true;
     }
+    outbound_expiry = futureMillis(max_airtime);
+
+  #if MESH_PACKET_LOGGING
+    Serial.print(getLogDateTime());
+    Serial.printf(": TX, len=%d payload_len=%d", len, outbound->payload_len);
+    Serial.printf("\n");
+  #endif
+  }
+  return true;
+}
+
+int Dispatcher::nextTimedIdx() const {
+  int best = -1;
+  for (int i = 0; i < num_timed; i++) {
+    if (best < 0 || (int32_t)(timed_at[i] - timed_at[best]) < 0) best = i;
+  }
+  return best;
+}
+
+void Dispatcher::checkTimedSend() {
+  if (num_timed == 0 || outbound != NULL) return;
+
+  int i = nextTimedIdx();
+  uint32_t at = timed_at[i];
+  int32_t until = (int32_t)(at - _ms->getMicros());
+  if (until > TIMED_TX_LEAD_MICROS) return;   // not yet
+
+  Packet* pkt = timed_tx[i];
+  num_timed--;
+  timed_tx[i] = timed_tx[num_timed];   // unordered, so just move last one into the gap
+  timed_at[i] = timed_at[num_timed];
+
+  uint8_t status = TIMED_TX_SENT;
+  if (until < -TIMED_TX_MAX_LATE_MICROS) {
+    MESH_DEBUG_PRINTLN("%s Dispatcher::checkTimedSend(): missed start time by %d us", getLogDateTime(), -until);
+    status = TIMED_TX_MISSED;
+  } else if (!onBeforePacketTx(pkt)) {
+    status = TIMED_TX_FAILED;
   }
+  if (status != TIMED_TX_SENT) {
+    onTimedTx(pkt, status, 0, -until);
+    logTxFail(pkt, pkt->getRawLength());
+    releasePacket(pkt);  // return to pool
+    return;
+  }
+
+  uint32_t max_airtime = _radio->getEstAirtimeFor(pkt->payload_len)*3/2;
+  while ((int32_t)(at - _ms->getMicros()) > 0) { }   // spin until start time, at most TIMED_TX_LEAD_MICROS
+
+  bool success = _radio->startSendRaw(pkt->payload, pkt->payload_len);
+  uint32_t start = _ms->getMicros();
+  if (!success) {
+    MESH_DEBUG_PRINTLN("%s Dispatcher::checkTimedSend(): ERROR: send start failed!", getLogDateTime());
+    onAfterPacketTx(pkt);
+    onTimedTx(pkt, TIMED_TX_FAILED, 0, 0);
+    logTxFail(pkt, pkt->getRawLength());
+    releasePacket(pkt);  // return to pool
+    return;
+  }
+  outbound = pkt;   // completes in loop(), like any other send
+  outbound_timed = true;
+  outbound_start = _ms->getMillis();
+  outbound_expiry = futureMillis(max_airtime);
+  onTimedTx(pkt, TIMED_TX_SENT, start, (int32_t)(start - at));
+}
+
+bool Dispatcher::sendPacketAt(Packet* packet, uint32_t at_micros) {
+  if (num_timed >= MAX_TIMED_TX || packet->payload_len > MAX_TRANS_UNIT) {   // (sent as is, see checkTimedSend())
+    MESH_DEBUG_PRINTLN("%s Dispatcher::sendPacketAt(): ERROR: timed queue full, or invalid packet", getLogDateTime());
+    _mgr->free(packet);
+    return false;
+  }
+  stampQueued(packet);
+  timed_tx[num_timed] = packet;
+  timed_at[num_timed] = at_micros;
+  num_timed++;
+  return true;
+}
+
+void Dispatcher::stampQueued(Packet* pkt) {
+  pkt->queue_id = next_queue_id++;
+  if (next_queue_id == 0) next_queue_id = 1;   // 0 is never used
+  pkt->queued_at = _ms->getMillis();
+  pkt->queued_micros = 0;
+}
+
+const Packet* Dispatcher::getQueued(int i, uint8_t& priority, int32_t& due_millis) {
+  int num_outbound = _mgr->getOutboundTotal();
+  if (i < 0 || i >= num_outbound + num_timed) return NULL;
+
+  if (i < num_outbound) {
+    priority = _mgr->getOutboundPriority(i);
+    due_millis = (int32_t)(_mgr->getOutboundScheduledFor(i) - _ms->getMillis());
+    return _mgr->getOutboundByIdx(i);
+  }
+  i -= num_outbound;
+  priority = QUEUED_PRIORITY_TIMED;
+  due_millis = (int32_t)(timed_at[i] - _ms->getMicros()) / 1000;
+  return timed_tx[i];
+}
+
+int Dispatcher::cancelQueuedWhere(bool by_tag, uint32_t value) {
+  if (by_tag && value == 0) return 0;   // 0 is untagged, not a tag
+  int n = 0;
+  for (int i = _mgr->getOutboundTotal() - 1; i >= 0; i--) {   // backwards, as removing shifts the rest down
+    Packet* pkt = _mgr->getOutboundByIdx(i);
+    if ((by_tag ? pkt->host_tag : pkt->queue_id) != value) continue;
+    _mgr->free(_mgr->removeOutboundByIdx(i));
+    n++;
+  }
+  for (int i = num_timed - 1; i >= 0; i--) {
+    Packet* pkt = timed_tx[i];
+    if ((by_tag ? pkt->host_tag : pkt->queue_id) != value) continue;
+    num_timed--;
+    timed_tx[i] = timed_tx[num_timed];
+    timed_at[i] = timed_at[num_timed];
+    _mgr->free(pkt);
+    n++;
+  }
+  return n;
 }
 
 Packet* Dispatcher::obtainNewPacket() {
@@ -229,6 +462,10 @@ Packet* Dispatcher::obtainNewPacket() {
   } else {
     pkt->payload_len = 0;
     pkt->_snr = 0;
+    memset(&pkt->rx_meta, 0, sizeof(pkt->rx_meta));
+    memset(&pkt->tx_ovr, 0, sizeof(pkt->tx_ovr));
+    pkt->host_tag = 0;
+    pkt->tx_class = 0;
   }
   return pkt;
 }
@@ -242,10 +479,44 @@ void Dispatcher::sendPacket(Packet* packet, uint8_t priority, uint32_t delay_mil
     MESH_DEBUG_PRINTLN("%s Dispatcher::sendPacket(): ERROR: invalid packet... payload_len=%d", getLogDateTime(), (uint32_t) packet->payload_len);
     _mgr->free(packet);
   } else {
+    stampQueued(packet);
+    if (delay_millis == 0) packet->queued_micros = _ms->getMicros();
     _mgr->queueOutbound(packet, priority, futureMillis(delay_millis));
   }
 }
 
+void Dispatcher::sendPacketNow(Packet* packet, uint8_t priority) {
+  uint32_t start = _ms->getMicros();
+  if (packet->payload_len > MAX_PACKET_PAYLOAD || !useCutThrough() || !canCutThrough(packet)) {
+    sendPacket(packet, priority, 0);
+    return;
+  }
+  stampQueued(packet);
+  packet->queued_micros = start;
+  outbound = packet;
+  if (!startOutbound(true, getTxSlotRemaining() < 0)) {   // busy on its tx_ovr channel, queue it instead
+    outbound = NULL;
+    _mgr->queueOutbound(packet, priority, _ms->getMillis());
+  }
+}
+
+// the same conditions checkSend() would send under, with nothing else to send first
+bool Dispatcher::canCutThrough(const Packet* packet) {
+  if (outbound != NULL || num_timed > 0) return false;
+
+  // TX would lose a packet being received, or still in the radio's buffer. Leave it for loop() (this may
+  // be called from host input handling, so don't process received packets from here)
+  if (_radio->isRecvPending()) return false;
+  if (_mgr->getOutboundTotal() > 0) return false;   // don't jump the queue
+
+  int slot_left = getTxSlotRemaining();
+  if (slot_left >= 0) {   // TDMA
+    return slot_left > 0 && getEstAirtimeFor(packet) <= (uint32_t) slot_left;
+  }
+  if (!millisHasNowPassed(next_tx_time)) return false;
+  return !isChannelBusy();   // on the receive channel, startOutbound() checks any tx_ovr channel
+}
+
 // Utility function -- handles the case where millis() wraps around back to zero
 //   2's complement arithmetic will handle any unsigned subtraction up to HALF the word size (32-bits in this case)
 bool Dispatcher::millisHasNowPassed(unsigned long timestamp) const {
@@ -13,6 +13,7 @@ namespace mesh {
 class MillisecondClock {
 public:
   virtual unsigned long getMillis() = 0;
+  virtual uint32_t getMicros() { return getMillis() * 1000; }
 };
 
 /**
@@ -52,8 +53,9 @@ public:
 
   /**
    * \brief  a hook for doing any necessary clean up after transmit.
+   * \param  rearm  false if the radio is about to be reconfigured, which then restarts Rx itself
   */
-  virtual void onSendFinished() = 0;
+  virtual void onSendFinished(bool rearm) = 0;
 
   /**
    * \brief  do any processing needed on each loop cycle
@@ -73,8 +75,58 @@ public:
   */
   virtual bool isReceiving() { return false; }
 
+  /**
+   * \returns  true if a packet is being received, or is waiting to be read by recvRaw()
+  */
+  virtual bool isRecvPending() { return isReceiving(); }
+
   virtual float getLastRSSI() const { return 0; }
   virtual float getLastSNR() const { return 0; }
+
+  /**
+   * \brief  details of the last packet returned by recvRaw(), read in one go before the radio resumes RX.
+  */
+  virtual void getLastRxMeta(RxMetadata& meta) const {
+    meta.rssi = meta.signal_rssi = getLastRSSI();
+    meta.snr = getLastSNR();
+    meta.freq_error = 0;
+    meta.rx_micros = 0;
+    meta.len = 0;
+    meta.crc_ok = true;
+  }
+
+  /**
+   * \brief  listen-before-talk using the radio's Channel Activity Detection, which also sees LoRa signals
+   *         below the noise floor. Radios without CAD fall back to isReceiving().  NOTE: blocks for a few symbols.
+   * \returns  true if the channel is busy
+  */
+  virtual bool isChannelBusyCAD() { return isReceiving(); }
+
+  /**
+   * \brief  true if the last isChannelBusyCAD() could not run a CAD, ie. the chip returned an error
+  */
+  virtual bool isCADFaulty() const { return false; }
+
+  /**
+   * \returns  micros from the last TX done interrupt until the radio was receiving again, 0 if not measured
+  */
+  virtual uint32_t getTxTurnaroundMicros() const { return 0; }
+  virtual uint32_t getMaxTxTurnaroundMicros() const { return 0; }
+
+  /**
+   * \returns  micros the last change of radio params took (ie. time not receiving), 0 if not measured
+  */
+  virtual uint32_t getReconfigMicros() const { return 0; }
+};
+
+/**
+ * \brief  per traffic class counters of the outbound queue.
+*/
+struct TxClassStats {
+  uint8_t weight;
+  uint16_t queued;        // including those scheduled for the future
+  uint32_t n_sent;
+  uint32_t airtime;       // millis
 };
 
 /**
@@ -88,12 +140,25 @@ public:
 
   virtual void queueOutbound(Packet* packet, uint8_t priority, uint32_t scheduled_for) = 0;
   virtual Packet* getNextOutbound(uint32_t now) = 0;    // by priority
+  virtual Packet* getNextOutbound(uint32_t now, int max_len) = 0;    // by priority, amongst those of payload_len <= max_len
+  virtual void returnOutbound(Packet* packet) = 0;    // puts back the last getNextOutbound(), as if never taken
   virtual int getOutboundCount(uint32_t now) const = 0;
   virtual int getFreeCount() const = 0;
+  virtual int getOutboundTotal() const = 0;    // including those scheduled for the future
   virtual Packet* getOutboundByIdx(int i) = 0;
+  virtual uint8_t getOutboundPriority(int i) const = 0;
+  virtual uint32_t getOutboundScheduledFor(int i) const = 0;
   virtual Packet* removeOutboundByIdx(int i) = 0;
   virtual void queueInbound(Packet* packet, uint32_t scheduled_for) = 0;
   virtual Packet* getNextInbound(uint32_t now) = 0;
+
+  /**
+   * \brief  called once a packet from the outbound queue has been transmitted, with the airtime it took
+  */
+  virtual void onPacketSent(const Packet* packet, uint32_t airtime_millis) { }
+  virtual void setClassWeight(uint8_t tx_class, uint8_t weight) { }
+  virtual bool getClassStats(uint8_t tx_class, TxClassStats& stats) const { return false; }
+  virtual void resetClassStats() { }
 };
 
 typedef uint32_t  DispatcherAction;
@@ -107,12 +172,30 @@ typedef uint32_t  DispatcherAction;
 #define ERR_EVENT_CAD_TIMEOUT       (1 << 1)
 #define ERR_EVENT_STARTRX_TIMEOUT   (1 << 2)
 
+#ifndef MAX_TIMED_TX
+  #define MAX_TIMED_TX               8
+#endif
+#ifndef TIMED_TX_LEAD_MICROS
+  #define TIMED_TX_LEAD_MICROS       5000    // radio is readied this far ahead, then the loop spins until the start time
+#endif
+#ifndef TIMED_TX_MAX_LATE_MICROS
+  #define TIMED_TX_MAX_LATE_MICROS   2000    // later than this, the packet is dropped rather than sent
+#endif
+
+// onTimedTx() status
+#define TIMED_TX_SENT       0
+#define TIMED_TX_MISSED     1   // start time had already passed
+#define TIMED_TX_FAILED     2   // radio rejected the packet, or its tx_ovr
+
+#define QUEUED_PRIORITY_TIMED   0xFF   // getQueued() priority, for a sendPacketAt() packet
+
 /**
  * \brief  The low-level task that manages detecting incoming Packets, and the queueing
  *      and scheduling of outbound Packets.
 */
 class Dispatcher {
   Packet* outbound;  // current outbound packet
+  bool outbound_timed;   // it came from sendPacketAt(), not the outbound queue
   unsigned long outbound_expiry, outbound_start, total_air_time;
   unsigned long next_tx_time;
   unsigned long cad_busy_start;
@@ -121,8 +204,18 @@ class Dispatcher {
   bool  prev_isrecv_mode;
   uint32_t n_sent_flood, n_sent_direct;
   uint32_t n_recv_flood, n_recv_direct;
+  uint32_t n_cut_through, n_queued_now;      // sends that were wanted straight away
+  uint64_t cut_through_micros, queued_now_micros;   // total queue-to-air latency of each
+  Packet* timed_tx[MAX_TIMED_TX];   // unordered
+  uint32_t timed_at[MAX_TIMED_TX];  // micros() start times
+  int num_timed;
+  uint16_t next_queue_id;
 
   void processRecvPacket(Packet* pkt);
+  void stampQueued(Packet* pkt);
+  int cancelQueuedWhere(bool by_tag, uint32_t value);
+  int nextTimedIdx() const;
+  bool canCutThrough(const Packet* packet);
 
 protected:
   PacketManager* _mgr;
@@ -133,17 +226,45 @@ protected:
   Dispatcher(Radio& radio, MillisecondClock& ms, PacketManager& mgr)
     : _radio(&radio), _ms(&ms), _mgr(&mgr)
   {
-    outbound = NULL; total_air_time = 0; next_tx_time = 0;
+    outbound = NULL; outbound_timed = false; total_air_time = 0; next_tx_time = 0;
     cad_busy_start = 0;
     next_floor_calib_time = next_agc_reset_time = 0;
     _err_flags = 0;
     radio_nonrx_start = 0;
     prev_isrecv_mode = true;
+    num_timed = 0;
+    next_queue_id = 1;
   }
 
   virtual DispatcherAction onRecvPacket(Packet* pkt) = 0;
 
-  virtual void logRxRaw(float snr, float rssi, const uint8_t raw[], int len) { }   // custom hook
+  virtual void logRxRaw(const RxMetadata& meta, const uint8_t raw[], int len) { }   // custom hook
+
+  /**
+   * \brief  called when the radio looks stuck. (ERR_EVENT_STARTRX_TIMEOUT, or ERR_EVENT_CAD_TIMEOUT)
+   *         Called again each getStartRxTimeout() that the radio stays out of Rx. A CAD timeout is only
+   *         a fault if the radio is also out of Rx, or its CAD is failing, not just for a busy channel.
+  */
+  virtual void onRadioFault(uint16_t err_event) { }
+
+  /**
+   * \brief  called just before a packet is handed to the radio, to apply its Packet::tx_ovr
+   * \returns  false if the packet cannot be sent (it is then dropped)
+  */
+  virtual bool onBeforePacketTx(const Packet* packet) { return true; }
+  /**
+   * \brief  called once the radio is done with a packet that onBeforePacketTx() accepted (sent, or timed out).
+   *         For a packet with tx_ovr, Rx is not re-armed until this is done, so it starts on the restored settings.
+  */
+  virtual void onAfterPacketTx(const Packet* packet) { }
+
+  /**
+   * \brief  outcome of a sendPacketAt(). Called just before the packet is released.
+   * \param  status  TIMED_TX_*
+   * \param  start_micros  getMicros() when TX started (TIMED_TX_SENT only)
+   * \param  late_micros  how far after its start time the packet was sent (or found to be missed)
+  */
+  virtual void onTimedTx(const Packet* packet, uint8_t status, uint32_t start_micros, int32_t late_micros) { }
 
   virtual void logRx(Packet* packet, int len, float score) { }   // hooks for custom logging
   virtual void logTx(Packet* packet, int len) { }
@@ -154,8 +275,27 @@ protected:
   virtual int calcRxDelay(float score, uint32_t air_time) const;
   virtual uint32_t getCADFailRetryDelay() const;
   virtual uint32_t getCADFailMaxDuration() const;
+  virtual uint32_t getStartRxTimeout() const { return 8000; }
   virtual int getInterferenceThreshold() const { return 0; }    // disabled by default
   virtual int getAGCResetInterval() const { return 0; }    // disabled by default
+  virtual bool useCADForLBT() const { return false; }    // RSSI only by default
+  virtual bool useCutThrough() const { return false; }   // see sendPacketNow()
+
+  /**
+   * \brief  TDMA hook. While this returns >= 0, sends are fitted into this node's slots instead of using
+   *         listen-before-talk and the airtime budget.
+   * \returns  millis left to transmit in the current slot (0 if not in one), or -1 for no TDMA
+  */
+  virtual int getTxSlotRemaining() { return -1; }
+  /**
+   * \returns  the most getTxSlotRemaining() can be (TDMA only)
+  */
+  virtual uint32_t getTxSlotMax() { return 0; }
+
+  /**
+   * \returns  estimated air-time of the packet with its Packet::tx_ovr applied, in milliseconds
+  */
+  virtual uint32_t getEstAirtimeFor(const Packet* packet) { return _radio->getEstAirtimeFor(packet->payload_len); }
 
 public:
   void begin();
@@ -165,13 +305,58 @@ public:
   void releasePacket(Packet* packet);
   void sendPacket(Packet* packet, uint8_t priority, uint32_t delay_millis=0);
 
+  /**
+   * \brief  like sendPacket() with no delay, but when useCutThrough() and nothing else is waiting, the silence
+   *         period is over and listen-before-talk finds the channel clear, the packet starts transmitting
+   *         before this returns, instead of waiting for the next loop().
+  */
+  void sendPacketNow(Packet* packet, uint8_t priority);
+
+  /**
+   * \brief  queue a packet to start transmitting at an exact time, ahead of all other packets.
+   *         Listen-before-talk and the airtime budget don't apply, and other packets are held back while one
+   *         could still be on air at that time.
+   * \param  at_micros  getMicros() time to start TX
+   * \returns  false if there are already MAX_TIMED_TX queued, or the packet is longer than MAX_TRANS_UNIT (packet is released)
+  */
+  bool sendPacketAt(Packet* packet, uint32_t at_micros);
+  int getTimedCount() const { return num_timed; }
+
+  /**
+   * \returns  number of packets waiting to be sent (not counting one being sent now), normal then timed
+  */
+  int getQueuedCount() const { return _mgr->getOutboundTotal() + num_timed; }
+  /**
+   * \param  i  0 .. getQueuedCount()-1
+   * \param  priority  (OUT) queue priority, or QUEUED_PRIORITY_TIMED
+   * \param  due_millis  (OUT) millis until it is due to be sent (negative when overdue)
+   * \returns  NULL if 'i' is out of range
+  */
+  const Packet* getQueued(int i, uint8_t& priority, int32_t& due_millis);
+  /**
+   * \brief  removes queued packet(s) before they are sent, back to the pool. (host_tag 0 is untagged, matches none)
+   * \returns  number of packets removed
+  */
+  int cancelQueued(uint16_t queue_id) { return cancelQueuedWhere(false, queue_id); }
+  int cancelQueuedByTag(uint32_t host_tag) { return cancelQueuedWhere(true, host_tag); }
+
+  bool isSending() const { return outbound != NULL; }
   unsigned long getTotalAirTime() const { return total_air_time; }  // in milliseconds
   uint32_t getNumSentFlood() const { return n_sent_flood; }
   uint32_t getNumSentDirect() const { return n_sent_direct; }
   uint32_t getNumRecvFlood() const { return n_recv_flood; }
   uint32_t getNumRecvDirect() const { return n_recv_direct; }
+  uint32_t getNumCutThrough() const { return n_cut_through; }
+  /**
+   * \returns  average micros from sendPacketNow() (or sendPacket() with no delay) to the start of TX,
+   *           for packets that were cut through, or that went via the queue
+  */
+  uint32_t getCutThroughLatency() const { return n_cut_through ? cut_through_micros / n_cut_through : 0; }
+  uint32_t getQueuedLatency() const { return n_queued_now ? queued_now_micros / n_queued_now : 0; }
   void resetStats() {
     n_sent_flood = n_sent_direct = n_recv_flood = n_recv_direct = 0;
+    n_cut_through = n_queued_now = 0;
+    cut_through_micros = queued_now_micros = 0;
     _err_flags = 0;
   }
 
@@ -182,6 +367,12 @@ public:
 private:
   void checkRecv();
   void checkSend();
+  void checkTimedSend();
+  bool startOutbound(bool cut_through, bool lbt);
+  bool isChannelBusy();
+  int maxLenForAirtime(uint32_t air_ms);
+  Packet* getNextForSlot(int slot_left);
+  void dropTooLongForSlot();
 };
 
 }
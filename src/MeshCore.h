@@ -67,6 +67,16 @@ public:
   */
   virtual void setCurrentTime(uint32_t time) = 0;
 
+  /**
+   * \returns  the current time, in UNIX epoch milliseconds. (default impl has only seconds resolution)
+  */
+  virtual uint64_t getCurrentTimeMillis() { return ((uint64_t) getCurrentTime()) * 1000; }
+
+  /**
+   * \brief  call regularly from the main loop, for clocks with background work to do
+  */
+  virtual void tick() { }
+
   uint32_t getCurrentTimeUnique() {
     uint32_t t = getCurrentTime();
     if (t <= last_unique) {
@@ -6,6 +6,13 @@ namespace mesh {
 
 Packet::Packet() {
   payload_len = 0;
+  memset(&rx_meta, 0, sizeof(rx_meta));
+  memset(&tx_ovr, 0, sizeof(tx_ovr));
+  host_tag = 0;
+  queue_id = 0;
+  queued_micros = 0;
+  tx_class = 0;
+  queued_at = 0;
 }
 
 int Packet::getRawLength() const {
@@ -4,6 +4,46 @@
 
 namespace mesh {
 
+/**
+ * \brief  radio details of a received packet, captured once when the packet is read from the radio.
+*/
+struct RxMetadata {
+  float rssi;           // packet RSSI, dBm
+  float snr;            // dB
+  float signal_rssi;    // RSSI of the de-spread LoRa signal, dBm
+  float freq_error;     // Hz, 0 if not supported by radio
+  uint32_t rx_micros;   // micros() at end of reception (from radio interrupt), 0 if not supported
+  uint16_t len;
+  bool crc_ok;
+};
+
+#ifndef MAX_TX_CLASSES
+  #define MAX_TX_CLASSES        4
+#endif
+
+#define TX_OVERRIDE_FREQ        0x01
+#define TX_OVERRIDE_BW          0x02
+#define TX_OVERRIDE_SF          0x04
+#define TX_OVERRIDE_CR          0x08
+#define TX_OVERRIDE_POWER       0x10
+#define TX_OVERRIDE_SYNC_WORD   0x20
+#define TX_OVERRIDE_CHANNEL     (TX_OVERRIDE_FREQ | TX_OVERRIDE_BW | TX_OVERRIDE_SF)   // what listen-before-talk hears
+#define TX_OVERRIDE_AIRTIME     (TX_OVERRIDE_BW | TX_OVERRIDE_SF | TX_OVERRIDE_CR)     // what changes time on air
+
+/**
+ * \brief  radio settings to use in place of the current ones, when transmitting one packet.
+ *         Only the fields flagged in 'flags' apply.
+*/
+struct TxOverrides {
+  uint8_t flags;      // TX_OVERRIDE_*
+  float freq;         // MHz
+  float bw;           // kHz
+  uint8_t sf;
+  uint8_t cr;
+  uint8_t sync_word;
+  uint8_t tx_power;   // dBm
+};
+
 /**
  * \brief  The fundamental transmission unit.
 */
@@ -14,6 +54,13 @@ public:
   uint16_t payload_len;
   uint8_t payload[MAX_PACKET_PAYLOAD];
   int8_t _snr;
+  RxMetadata rx_meta;
+  TxOverrides tx_ovr;
+  uint32_t host_tag;    // set by a KISS host, echoed back in its TX reports
+  uint16_t queue_id;    // assigned when queued to send, to look it up or cancel it by
+  unsigned long queued_at;   // millis
+  uint32_t queued_micros;    // getMicros() when queued to send straight away, to measure queue-to-air latency (else 0)
+  uint8_t tx_class;     // traffic class, 0..MAX_TX_CLASSES-1, that the send queue shares airtime between
 
   float getSNR() const { return ((float)_snr) / 4.0f; }
 
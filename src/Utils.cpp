@@ -150,4 +150,15 @@ int Utils::parseTextParts(char* text, const char* parts[], int max_num, char sep
   return num;
 }
 
-}
\ No newline at end of file
+uint32_t Utils::crc32(const uint8_t* data, int len, uint32_t crc) {
+  crc = ~crc;
+  while (len-- > 0) {
+    crc ^= *data++;
+    for (int k = 0; k < 8; k++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+}
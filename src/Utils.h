@@ -82,6 +82,11 @@ public:
   static int parseTextParts(char* text, const char* parts[], int max_num, char separator=',');
 
   static bool isHexChar(char c);
+
+  /**
+   * \brief  calculates the CRC-32 (IEEE 802.3) of 'len' bytes. Pass a previous result as 'crc' to continue a running CRC.
+   */
+  static uint32_t crc32(const uint8_t* data, int len, uint32_t crc=0);
 };
 
 }
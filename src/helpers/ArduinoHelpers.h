@@ -9,11 +9,13 @@ public:
   VolatileRTCClock() { millis_offset = 1715770351; } // 15 May 2024, 8:50pm
   uint32_t getCurrentTime() override { return (millis()/1000 + millis_offset); }
   void setCurrentTime(uint32_t time) override { millis_offset = time - millis()/1000; }
+  uint64_t getCurrentTimeMillis() override { return ((uint64_t) millis_offset) * 1000 + millis(); }
 };
 
 class ArduinoMillis : public mesh::MillisecondClock {
 public:
   unsigned long getMillis() override { return millis(); }
+  uint32_t getMicros() override { return micros(); }
 };
 
 class StdRNG : public mesh::RNG {
@@ -35,9 +35,21 @@ void AutoDiscoverRTCClock::begin(TwoWire& wire) {
   if(i2c_probe(wire,PCF8563_ADDRESS)){
     rtc_8563_success = rtc_8563.begin(&wire);
   }
+
+  if (hasHardwareRTC() && !_synced) {   // (begin() is called again on a radio re-init)
+    unsigned long now;
+    _base_ms = readAlignedTime(now);   // NOTE: blocks up to RTC_ALIGN_TIMEOUT_MILLIS, only at startup
+    _base_millis = _last_sync = now;
+    _last_ms = 0;
+    _synced = true;
+  }
 }
 
-uint32_t AutoDiscoverRTCClock::getCurrentTime() {
+bool AutoDiscoverRTCClock::hasHardwareRTC() const {
+  return ds3231_success || rv3028_success || rtc_8563_success;
+}
+
+uint32_t AutoDiscoverRTCClock::readHardwareTime() {
   if (ds3231_success) {
     return rtc_3231.now().unixtime();
   }
@@ -54,7 +66,94 @@ uint32_t AutoDiscoverRTCClock::getCurrentTime() {
   if(rtc_8563_success){
     return rtc_8563.now().unixtime();
   }
-  return _fallback->getCurrentTime();
+  return 0;
+}
+
+// blocks until the hardware RTC's seconds change, so the millis() returned in 'now' is at the start of that second
+uint64_t AutoDiscoverRTCClock::readAlignedTime(unsigned long& now) {
+  uint32_t secs = readHardwareTime();
+  uint32_t t;
+  unsigned long start = millis();
+  while ((t = readHardwareTime()) == secs && millis() - start < RTC_ALIGN_TIMEOUT_MILLIS) {
+    delay(1);
+  }
+  now = millis();
+  return ((uint64_t) t) * 1000;   // (RTC not ticking: still a whole second, as before)
+}
+
+uint64_t AutoDiscoverRTCClock::extrapolate(unsigned long now) const {
+  unsigned long elapsed = now - _base_millis;
+  return _base_ms + elapsed + ((int64_t)elapsed * _drift_ppm) / 1000000;
+}
+
+// re-base on the start of the current RTC second, tick() then moves it to the next tick over
+void AutoDiscoverRTCClock::rebase(unsigned long now) {
+  _align_secs = readHardwareTime();
+  _base_ms = ((uint64_t) _align_secs) * 1000;   // early, so aligning only ever steps forward
+  _last_ms = 0;
+  _aligning = true;
+  _align_start = _align_poll = now;
+}
+
+void AutoDiscoverRTCClock::resync(unsigned long now) {
+  if (!_synced) {
+    rebase(now);
+  } else {
+    uint64_t lo = ((uint64_t) readHardwareTime()) * 1000;   // hardware RTC only has whole seconds,
+    uint64_t hi = lo + 999;                                   // so true time is somewhere in [lo, hi]
+    int64_t predicted = extrapolate(now);
+    if (predicted < (int64_t)lo - 2000 || predicted > (int64_t)hi + 2000) {
+      rebase(now);   // RTC was changed underneath us
+    } else {
+      int64_t corrected = predicted < (int64_t)lo ? lo : (predicted > (int64_t)hi ? hi : predicted);
+      unsigned long interval = now - _last_sync;
+      if (corrected != predicted && interval > 0) {
+        // nudge the drift estimate by a fraction of the observed error
+        int32_t err_ppm = (int32_t)(((corrected - predicted) * 1000000) / (int64_t)interval);
+        _drift_ppm = constrain(_drift_ppm + err_ppm / 4, -RTC_MAX_DRIFT_PPM, RTC_MAX_DRIFT_PPM);
+      }
+      _base_ms = corrected;
+    }
+  }
+  _base_millis = now;
+  _last_sync = now;
+  _synced = true;
+}
+
+void AutoDiscoverRTCClock::tick() {
+  if (!_aligning) return;
+
+  unsigned long now = millis();
+  if (now == _align_poll) return;   // at most one RTC read per millisecond
+  _align_poll = now;
+
+  uint32_t t = readHardwareTime();
+  if (t != _align_secs) {
+    _base_ms = ((uint64_t) t) * 1000;
+    _base_millis = _last_sync = now;
+    _aligning = false;
+  } else if (now - _align_start >= RTC_ALIGN_TIMEOUT_MILLIS) {
+    _aligning = false;   // RTC not ticking, stay on the whole second
+  }
+}
+
+uint64_t AutoDiscoverRTCClock::getCurrentTimeMillis() {
+  if (!hasHardwareRTC()) return _fallback->getCurrentTimeMillis();
+
+  unsigned long now = millis();
+  if (!_aligning && (!_synced || now - _last_sync >= RTC_RESYNC_INTERVAL_MILLIS)) {
+    resync(now);
+  }
+  uint64_t t = extrapolate(now);
+  if (t < _last_ms) return _last_ms;   // a correction stepped back, hold until time catches up
+  _last_ms = t;
+  return t;
+}
+
+uint32_t AutoDiscoverRTCClock::getCurrentTime() {
+  if (!hasHardwareRTC()) return _fallback->getCurrentTime();
+
+  return getCurrentTimeMillis() / 1000;
 }
 
 void AutoDiscoverRTCClock::setCurrentTime(uint32_t time) { 
@@ -69,4 +168,10 @@ void AutoDiscoverRTCClock::setCurrentTime(uint32_t time) {
   } else {
     _fallback->setCurrentTime(time);
   }
+
+  _base_ms = ((uint64_t) time) * 1000;   // (DS3231 and RV3028 restart the second when it's written, so this is aligned)
+  _base_millis = _last_sync = millis();
+  _last_ms = 0;
+  _aligning = false;
+  _synced = true;
 }
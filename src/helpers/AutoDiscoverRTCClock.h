@@ -4,14 +4,52 @@
 #include <Arduino.h>
 #include <Wire.h>
 
+#ifndef RTC_RESYNC_INTERVAL_MILLIS
+  #define RTC_RESYNC_INTERVAL_MILLIS  (60*1000)   // how often to re-read the hardware RTC
+#endif
+
+#define RTC_MAX_DRIFT_PPM   500
+#define RTC_ALIGN_TIMEOUT_MILLIS  1100   // longest wait for the RTC's seconds to tick over
+
+/**
+ * \brief  Uses an external I2C RTC if one is found, otherwise the 'fallback' clock.
+ *         The hardware RTC is only read every RTC_RESYNC_INTERVAL_MILLIS, in between the time is
+ *         extrapolated from millis(), with the local oscillator's drift tracked against the RTC.
+ *         begin() waits for the RTC's seconds to tick over, to line the millis up with it. A later re-base
+ *         (RTC changed underneath) starts on the whole second read, then tick() watches for the next
+ *         tick over without blocking. The time returned never goes backwards (other than when re-based or set).
+*/
 class AutoDiscoverRTCClock : public mesh::RTCClock {
   mesh::RTCClock* _fallback;
+  uint64_t _base_ms;            // epoch millis at _base_millis
+  unsigned long _base_millis;
+  unsigned long _last_sync;
+  int32_t _drift_ppm;           // millis() error vs hardware RTC, in parts-per-million
+  bool _synced;
+  uint64_t _last_ms;            // last getCurrentTimeMillis()
+  bool _aligning;               // waiting in tick() for the RTC's seconds to change from _align_secs
+  uint32_t _align_secs;
+  unsigned long _align_start, _align_poll;
 
   bool i2c_probe(TwoWire& wire, uint8_t addr);
+  bool hasHardwareRTC() const;
+  uint32_t readHardwareTime();
+  uint64_t readAlignedTime(unsigned long& now);
+  uint64_t extrapolate(unsigned long now) const;
+  void resync(unsigned long now);
+  void rebase(unsigned long now);
+
 public:
-  AutoDiscoverRTCClock(mesh::RTCClock& fallback) : _fallback(&fallback) { }
+  AutoDiscoverRTCClock(mesh::RTCClock& fallback) : _fallback(&fallback) {
+    _base_ms = 0; _base_millis = _last_sync = 0; _drift_ppm = 0; _synced = false; _last_ms = 0;
+    _aligning = false; _align_secs = 0; _align_start = _align_poll = 0;
+  }
 
   void begin(TwoWire& wire);
   uint32_t getCurrentTime() override;
   void setCurrentTime(uint32_t time) override;
+  uint64_t getCurrentTimeMillis() override;
+  void tick() override;
+
+  int32_t getDriftPPM() const { return _drift_ppm; }
 };
@@ -1,6 +1,7 @@
 #include <Arduino.h>
 #include "CommonCLI.h"
 #include "TxtDataHelpers.h"
+#include "TDMASchedule.h"
 #include <RTClib.h>
 
 // Believe it or not, this std C function is busted on some platforms!
@@ -14,16 +15,172 @@ static uint32_t _atoi(const char* sp) {
 }
 
 void CommonCLI::loadPrefs(FILESYSTEM* fs) {
-  if (fs->exists("/com_prefs")) {
-    loadPrefsInt(fs, "/com_prefs");   // new filename
-  } else if (fs->exists("/node_prefs")) {
-    loadPrefsInt(fs, "/node_prefs");
+  int res = loadPrefsFile(fs, PREFS_FILE);
+  if (res == PREFS_LOAD_OK) return;
+
+  if (loadPrefsFile(fs, PREFS_FILE_NEW) == PREFS_LOAD_OK) {
+    savePrefs(fs);   // commit was interrupted before the rename, finish it now
+  } else if (res == PREFS_LOAD_LEGACY) {
+    loadPrefsLegacy(fs, PREFS_FILE);
+    savePrefs(fs);  // convert to versioned format
+  } else if (res == PREFS_LOAD_NOT_FOUND && fs->exists("/node_prefs")) {
+    loadPrefsLegacy(fs, "/node_prefs");
     savePrefs(fs);  // save to new filename
     fs->remove("/node_prefs");  // remove old
   }
 }
 
-void CommonCLI::loadPrefsInt(FILESYSTEM* fs, const char* filename) {
+bool CommonCLI::isValidFSKParams(float freq, float bitrate, float freq_dev, float rx_bw) {
+  return freq >= 300.0f && freq <= 2500.0f &&
+         bitrate >= FSK_MIN_BITRATE && bitrate <= FSK_MAX_BITRATE &&
+         freq_dev >= 0.6f && freq_dev <= 200.0f &&
+         rx_bw >= 4.8f && rx_bw <= 500.0f;
+}
+
+void CommonCLI::sanitisePrefs() {
+  _prefs->rx_delay_base = constrain(_prefs->rx_delay_base, 0, 20.0f);
+  _prefs->tx_delay_factor = constrain(_prefs->tx_delay_factor, 0, 2.0f);
+  _prefs->airtime_factor = constrain(_prefs->airtime_factor, 0, 9.0f);
+  _prefs->freq = constrain(_prefs->freq, 400.0f, 2500.0f);
+  _prefs->bw = constrain(_prefs->bw, 62.5f, 500.0f);
+  _prefs->sf = constrain(_prefs->sf, 5, 12);
+  _prefs->cr = constrain(_prefs->cr, 5, 8);
+  _prefs->tx_power_dbm = constrain(_prefs->tx_power_dbm, 1, 30);
+  _prefs->kiss_port = constrain(_prefs->kiss_port, 0, 15);
+  _prefs->lbt_mode = constrain(_prefs->lbt_mode, LBT_MODE_RSSI, LBT_MODE_CAD);
+  _prefs->num_scan_profiles = constrain(_prefs->num_scan_profiles, 0, MAX_SCAN_PROFILES);
+  _prefs->modem = constrain(_prefs->modem, MODEM_LORA, MODEM_FSK);
+  _prefs->fsk_bitrate = constrain(_prefs->fsk_bitrate, FSK_MIN_BITRATE, FSK_MAX_BITRATE);
+  _prefs->lora_opts &= LORA_OPT_ALL;
+  if (_prefs->lora_implicit_len == 0) _prefs->lora_opts &= ~LORA_OPT_IMPLICIT_HDR;
+  if (_prefs->lora_preamble != 0 && _prefs->lora_preamble < LORA_MIN_PREAMBLE) _prefs->lora_preamble = LORA_MIN_PREAMBLE;
+  _prefs->num_radio_profiles = constrain(_prefs->num_radio_profiles, 0, MAX_RADIO_PROFILES);
+  for (int i = 0; i < _prefs->num_radio_profiles; i++) {
+    _prefs->radio_profiles[i].name[RADIO_PROFILE_NAME_LEN - 1] = 0;
+  }
+  _prefs->frag_fec_repairs = constrain(_prefs->frag_fec_repairs, 0, FRAG_FEC_MAX_REPAIRS);
+  _prefs->frag_agg_hold = constrain(_prefs->frag_agg_hold, 0, FRAG_AGG_MAX_HOLD_MILLIS);
+  for (int c = 0; c < MAX_TX_CLASSES; c++) {
+    _prefs->qos_weights[c] = constrain(_prefs->qos_weights[c], 1, QOS_MAX_WEIGHT);   // 0 from older prefs files = 1
+  }
+}
+
+void CommonCLI::packRadioPrefs(RadioProfile& p) const {
+  memset(&p, 0, sizeof(p));
+  p.freq_hz = (uint32_t) (_prefs->freq * 1000000.0 + 0.5);
+  p.modem = _prefs->modem;
+  p.sync_word = _prefs->sync_word;
+  if (_prefs->modem == MODEM_FSK) {
+    p.bw_10hz = (uint16_t) (_prefs->fsk_rx_bw * 100.0f + 0.5f);
+    p.bitrate_100bps = (uint16_t) (_prefs->fsk_bitrate * 10.0f + 0.5f);
+    p.freq_dev_10hz = (uint16_t) (_prefs->fsk_freq_dev * 100.0f + 0.5f);
+  } else {
+    p.bw_10hz = (uint16_t) (_prefs->bw * 100.0f + 0.5f);
+    p.sf_cr = (_prefs->sf << 4) | _prefs->cr;
+    p.preamble = _prefs->lora_preamble;
+    p.lora_opts = _prefs->lora_opts;
+    p.implicit_len = _prefs->lora_implicit_len;
+  }
+}
+
+void CommonCLI::unpackRadioPrefs(const RadioProfile& p) {   // NOTE: settings of the other modem are left as they are
+  _prefs->freq = p.getFreq();
+  _prefs->modem = p.modem;
+  _prefs->sync_word = p.sync_word;
+  if (p.modem == MODEM_FSK) {
+    _prefs->fsk_rx_bw = p.getBW();
+    _prefs->fsk_bitrate = p.getBitrate();
+    _prefs->fsk_freq_dev = p.getFreqDev();
+  } else {
+    _prefs->bw = p.getBW();
+    _prefs->sf = p.getSF();
+    _prefs->cr = p.getCR();
+    _prefs->lora_preamble = p.preamble;
+    _prefs->lora_opts = p.lora_opts;
+    _prefs->lora_implicit_len = p.implicit_len;
+  }
+}
+
+// apply the radio settings now in prefs. If the radio rejects them, prefs go back to 'prev'
+bool CommonCLI::applyRadioPrefs(const NodePrefs& prev) {
+  if (_callbacks->applyPrefsRadio()) {
+    savePrefs();
+    return true;
+  }
+  *_prefs = prev;
+  return false;
+}
+
+int CommonCLI::formatLoRaOpts(char* dest, uint16_t preamble, uint8_t opts, uint8_t implicit_len, bool all) const {
+  char* dp = dest;
+  *dp = 0;
+  if (all || preamble) dp += sprintf(dp, ",pre:%d", (uint32_t) (preamble ? preamble : LORA_DEFAULT_PREAMBLE));
+  if (opts & LORA_OPT_IMPLICIT_HDR) dp += sprintf(dp, ",hdr:implicit/%d", (uint32_t) implicit_len);
+  else if (all) dp += sprintf(dp, ",hdr:explicit");
+  if (all || (opts & LORA_OPT_NO_CRC)) dp += sprintf(dp, ",crc:%s", (opts & LORA_OPT_NO_CRC) ? "off" : "on");
+  if (all || (opts & LORA_OPT_INVERT_IQ)) dp += sprintf(dp, ",iq:%s", (opts & LORA_OPT_INVERT_IQ) ? "inverted" : "normal");
+  if (opts & LORA_OPT_LDRO_ON) dp += sprintf(dp, ",ldro:on");
+  else if (opts & LORA_OPT_LDRO_OFF) dp += sprintf(dp, ",ldro:off");
+  else if (all) dp += sprintf(dp, ",ldro:auto");
+  return dp - dest;
+}
+
+int CommonCLI::findRadioProfile(const char* name) const {
+  for (int i = 0; i < _prefs->num_radio_profiles; i++) {
+    if (strcmp(_prefs->radio_profiles[i].name, name) == 0) return i;
+  }
+  return -1;
+}
+
+int CommonCLI::loadPrefsFile(FILESYSTEM* fs, const char* filename) {
+  if (!fs->exists(filename)) return PREFS_LOAD_NOT_FOUND;
+
+#if defined(RP2040_PLATFORM)
+  File file = fs->open(filename, "r");
+#else
+  File file = fs->open(filename);
+#endif
+  if (!file) return PREFS_LOAD_NOT_FOUND;
+
+  PrefsFileHeader hdr;
+  if (file.read((uint8_t *) &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != PREFS_MAGIC) {
+    file.close();
+    return PREFS_LOAD_LEGACY;
+  }
+  if (hdr.version > PREFS_VERSION) {
+    file.close();
+    return PREFS_LOAD_CORRUPT;   // written by newer firmware, don't trust the layout
+  }
+
+  // read what we know about, but CRC all 'len' bytes (file may be from newer build with more fields)
+  NodePrefs tmp;
+  int n = hdr.len < sizeof(tmp) ? hdr.len : sizeof(tmp);
+  uint32_t crc = 0;
+  bool ok = file.read((uint8_t *) &tmp, n) == n;
+  if (ok) crc = mesh::Utils::crc32((uint8_t *) &tmp, n);
+
+  uint8_t extra[16];
+  int remaining = hdr.len - n;
+  while (ok && remaining > 0) {
+    int sz = remaining < sizeof(extra) ? remaining : sizeof(extra);
+    ok = file.read(extra, sz) == sz;
+    crc = mesh::Utils::crc32(extra, sz, crc);
+    remaining -= sz;
+  }
+  file.close();
+
+  if (!ok || crc != hdr.crc) {
+    MESH_DEBUG_PRINTLN("CommonCLI: prefs file %s is corrupt", filename);
+    return PREFS_LOAD_CORRUPT;
+  }
+
+  memcpy(_prefs, &tmp, n);   // any fields newer than file keep their defaults
+  sanitisePrefs();
+  return PREFS_LOAD_OK;
+}
+
+// the original (unversioned) field-by-field layout, only read now to migrate old files
+void CommonCLI::loadPrefsLegacy(FILESYSTEM* fs, const char* filename) {
 #if defined(RP2040_PLATFORM)
   File file = fs->open(filename, "r");
 #else
@@ -57,76 +214,76 @@ void CommonCLI::loadPrefsInt(FILESYSTEM* fs, const char* filename) {
     file.read((uint8_t *) &_prefs->ble_active_scan, sizeof(_prefs->ble_active_scan));
     file.read((uint8_t *) &_prefs->ble_max_results, sizeof(_prefs->ble_max_results));
     file.read((uint8_t *) &_prefs->ble_scantime, sizeof(_prefs->ble_scantime));
+    file.read((uint8_t *) &_prefs->log_flash, sizeof(_prefs->log_flash));
 
-    // sanitise bad pref values
-    _prefs->rx_delay_base = constrain(_prefs->rx_delay_base, 0, 20.0f);
-    _prefs->tx_delay_factor = constrain(_prefs->tx_delay_factor, 0, 2.0f);
-    _prefs->airtime_factor = constrain(_prefs->airtime_factor, 0, 9.0f);
-    _prefs->freq = constrain(_prefs->freq, 400.0f, 2500.0f);
-    _prefs->bw = constrain(_prefs->bw, 62.5f, 500.0f);
-    _prefs->sf = constrain(_prefs->sf, 5, 12);
-    _prefs->cr = constrain(_prefs->cr, 5, 8);
-    _prefs->tx_power_dbm = constrain(_prefs->tx_power_dbm, 1, 30);
-    _prefs->kiss_port = constrain(_prefs->kiss_port, 0, 15);
+    sanitisePrefs();
 
     file.close();
   }
 }
 
 void CommonCLI::savePrefs(FILESYSTEM* fs) {
+  _prefs_dirty = false;
+
+  // write complete new file first, then replace the old one
 #if defined(NRF52_PLATFORM) || defined(STM32_PLATFORM)
-  fs->remove("/com_prefs");
-  File file = fs->open("/com_prefs", FILE_O_WRITE);
+  fs->remove(PREFS_FILE_NEW);
+  File file = fs->open(PREFS_FILE_NEW, FILE_O_WRITE);
 #elif defined(RP2040_PLATFORM)
-  File file = fs->open("/com_prefs", "w");
+  File file = fs->open(PREFS_FILE_NEW, "w");
 #else
-  File file = fs->open("/com_prefs", "w", true);
+  File file = fs->open(PREFS_FILE_NEW, "w", true);
 #endif
-  if (file) {
-    uint8_t pad[8];
-    memset(pad, 0, sizeof(pad));
-
-    file.write((uint8_t *) &_prefs->airtime_factor, sizeof(_prefs->airtime_factor));
-    file.write((uint8_t *) &_prefs->node_name, sizeof(_prefs->node_name));
-    file.write(pad, 4);
-    file.write((uint8_t *) &_prefs->node_lat, sizeof(_prefs->node_lat));
-    file.write((uint8_t *) &_prefs->node_lon, sizeof(_prefs->node_lon));
-    file.write((uint8_t *) &_prefs->freq, sizeof(_prefs->freq));
-    file.write((uint8_t *) &_prefs->tx_power_dbm, sizeof(_prefs->tx_power_dbm));
-    file.write((uint8_t *) pad, 1);
-    file.write((uint8_t *) &_prefs->rx_delay_base, sizeof(_prefs->rx_delay_base));
-    file.write((uint8_t *) &_prefs->tx_delay_factor, sizeof(_prefs->tx_delay_factor));
-    file.write(pad, 4);
-    file.write((uint8_t *) &_prefs->sf, sizeof(_prefs->sf));
-    file.write((uint8_t *) &_prefs->cr, sizeof(_prefs->cr));
-    file.write((uint8_t *) &_prefs->bw, sizeof(_prefs->bw));
-    file.write((uint8_t *) &_prefs->agc_reset_interval, sizeof(_prefs->agc_reset_interval));
-    file.write(pad, 3);
-    file.write((uint8_t *) &_prefs->interference_threshold, sizeof(_prefs->interference_threshold));
-    file.write((uint8_t *) &_prefs->sync_word, sizeof(_prefs->sync_word));
-    file.write(pad, 1);
-    file.write((uint8_t *) &_prefs->kiss_port, sizeof(_prefs->kiss_port));
-    file.write((uint8_t *) &_prefs->ble_enabled, sizeof(_prefs->ble_enabled));
-    file.write((uint8_t *) &_prefs->ble_filter_dups, sizeof(_prefs->ble_filter_dups));
-    file.write((uint8_t *) &_prefs->ble_active_scan, sizeof(_prefs->ble_active_scan));
-    file.write((uint8_t *) &_prefs->ble_max_results, sizeof(_prefs->ble_max_results));
-    file.write((uint8_t *) &_prefs->ble_scantime, sizeof(_prefs->ble_scantime));
+  if (!file) return;
 
-    file.close();
+  PrefsFileHeader hdr;
+  hdr.magic = PREFS_MAGIC;
+  hdr.version = PREFS_VERSION;
+  hdr.len = sizeof(NodePrefs);
+  hdr.crc = mesh::Utils::crc32((uint8_t *) _prefs, sizeof(NodePrefs));
+
+  bool ok = file.write((uint8_t *) &hdr, sizeof(hdr)) == sizeof(hdr)
+         && file.write((uint8_t *) _prefs, sizeof(NodePrefs)) == sizeof(NodePrefs);
+  file.close();
+
+  if (ok) {
+    if (!fs->rename(PREFS_FILE_NEW, PREFS_FILE)) {  // LittleFS replaces atomically, SPIFFS needs target removed
+      fs->remove(PREFS_FILE);
+      fs->rename(PREFS_FILE_NEW, PREFS_FILE);
+    }
+  } else {
+    MESH_DEBUG_PRINTLN("CommonCLI: prefs write failed");
+    fs->remove(PREFS_FILE_NEW);
   }
 }
 
 #define MIN_LOCAL_ADVERT_INTERVAL   60
 
 void CommonCLI::savePrefs() {
-  _callbacks->savePrefs();
+  // coalesce bursts of 'set' commands into a single flash write, after a quiet period
+  _prefs_dirty = true;
+  _prefs_dirty_at = millis();
+}
+
+void CommonCLI::commitPrefs() {
+  if (_prefs_dirty) {
+    _callbacks->savePrefs();
+    _prefs_dirty = false;
+  }
+}
+
+void CommonCLI::loop() {
+  _kiss.loop();
+  if (_prefs_dirty && millis() - _prefs_dirty_at >= PREFS_COMMIT_DELAY_MILLIS) {
+    commitPrefs();
+  }
 }
 
 void CommonCLI::handleSerialData() {
   if (_cli_mode == CLIMode::CLI) {
     parseSerialCLI();
-  } else if (_cli_mode == CLIMode::KISS) {
-    _kiss.parseSerialKISS();
+  } else if (_cli_mode == CLIMode::KISS || _cli_mode == CLIMode::PCAP) {
+    _kiss.parseSerialKISS();   // PCAP mode still accepts KISS frames (incl. the exit sequence)
   }
 }
 
@@ -169,6 +326,7 @@ void CommonCLI::handleCLICommand(
   char* resp
 ){
   if (memcmp(command, "reboot", 6) == 0) {
+    commitPrefs();   // don't lose any pending changes
     _board->reboot();  // doesn't return
   } else if (memcmp(command, "serial mode ", 12) == 0) {
     const char* mode = &command[12];
@@ -177,6 +335,12 @@ void CommonCLI::handleCLICommand(
       _kiss.reset();  // reset kiss length
       _cli_mode = CLIMode::KISS;
       return;
+    } else if (memcmp(mode, "pcap", 4) == 0) {
+      Serial.println("  -> Entering PCAP mode!");
+      _kiss.reset();
+      _pcap.reset();   // global header goes out ahead of first captured packet
+      _cli_mode = CLIMode::PCAP;
+      return;
     }
   } else if (memcmp(command, "txraw ", 6) == 0) {
     const char* tx_hex = &command[6];
@@ -196,7 +360,7 @@ void CommonCLI::handleCLICommand(
     }
     pkt->readFrom(tx_buf, len_buf);
     mesh::Utils::printHex(Serial, tx_buf, len_buf);
-    _mesh->sendPacket(pkt, 1);
+    _mesh->sendPacketNow(pkt, 1);
     strcpy(resp, "OK");
   } else if (memcmp(command, "clock sync", 10) == 0) {
     uint32_t curr = getRTCClock()->getCurrentTime();
@@ -233,6 +397,25 @@ void CommonCLI::handleCLICommand(
     } else {
       strcpy(resp, "(ERR: clock cannot go backwards)");
     }
+  } else if (memcmp(command, "tempradio fsk,", 14) == 0) {
+    strcpy(_tmp, &command[14]);
+    const char *parts[6];
+    int num = mesh::Utils::parseTextParts(_tmp, parts, 6);
+    float freq      = num > 0 ? atof(parts[0]) : 0.0f;
+    float bitrate   = num > 1 ? atof(parts[1]) : 0.0f;
+    float freq_dev  = num > 2 ? atof(parts[2]) : 0.0f;
+    float rx_bw     = num > 3 ? atof(parts[3]) : 0.0f;
+    uint8_t sync_word  = num > 4 ? strtol(parts[4], nullptr, 16) : 0;
+    int temp_timeout_mins  = num > 5 ? atoi(parts[5]) : 0;
+    if (isValidFSKParams(freq, bitrate, freq_dev, rx_bw) && temp_timeout_mins > 0) {
+      if (_callbacks->applyFSKParams(freq, bitrate, freq_dev, rx_bw, sync_word, temp_timeout_mins)) {
+        sprintf(resp, "OK - temp params for %d mins", temp_timeout_mins);
+      } else {
+        strcpy(resp, "Error, radio rejected params");
+      }
+    } else {
+      strcpy(resp, "Error, invalid params");
+    }
   } else if (memcmp(command, "tempradio ", 10) == 0) {
     strcpy(_tmp, &command[10]);
     const char *parts[6];
@@ -255,6 +438,149 @@ void CommonCLI::handleCLICommand(
     } else {
       strcpy(resp, "Error, invalid params");
     }
+  } else if (memcmp(command, "survey ", 7) == 0) {
+    strcpy(_tmp, &command[7]);
+    const char *parts[4];
+    int num = mesh::Utils::parseTextParts(_tmp, parts, 4);
+    float start_freq = num > 0 ? atof(parts[0]) : 0.0f;
+    float stop_freq  = num > 1 ? atof(parts[1]) : 0.0f;
+    float step_khz   = num > 2 ? atof(parts[2]) : 0.0f;
+    int samples      = num > 3 ? atoi(parts[3]) : SURVEY_DEFAULT_SAMPLES;
+    if (start_freq >= 150.0f && stop_freq >= start_freq && stop_freq <= 2500.0f && step_khz > 0.0f && samples > 0) {
+      int bins = _callbacks->runSurvey(start_freq, stop_freq, step_khz, samples);
+      if (bins > 0) {
+        sprintf(resp, "OK - %d bins", bins);
+      } else {
+        strcpy(resp, "Error, survey failed (radio busy?)");
+      }
+    } else {
+      strcpy(resp, "Error, invalid survey params");
+    }
+  } else if (memcmp(command, "scan add ", 9) == 0) {
+    strcpy(_tmp, &command[9]);
+    const char *parts[5];
+    int num = mesh::Utils::parseTextParts(_tmp, parts, 5);
+    float freq  = num > 0 ? atof(parts[0]) : 0.0f;
+    float bw    = num > 1 ? atof(parts[1]) : 0.0f;
+    uint8_t sf  = num > 2 ? atoi(parts[2]) : 0;
+    uint8_t cr  = num > 3 ? atoi(parts[3]) : 0;
+    uint8_t sync_word  = num > 4 ? strtol(parts[4], nullptr, 16) : 0;
+    if (_prefs->num_scan_profiles >= MAX_SCAN_PROFILES) {
+      sprintf(resp, "Error, max %d profiles", MAX_SCAN_PROFILES);
+    } else if (freq >= 300.0f && freq <= 2500.0f &&
+        sf >= 5 && sf <= 12 &&
+        cr >= 5 && cr <= 8 &&
+        bw >= 7.0f && bw <= 500.0f
+    ){
+      ScanProfile* p = &_prefs->scan_profiles[_prefs->num_scan_profiles++];
+      p->freq = freq;
+      p->bw = bw;
+      p->sf = sf;
+      p->cr = cr;
+      p->sync_word = sync_word;
+      savePrefs();
+      sprintf(resp, "OK - profile %d", (uint32_t) _prefs->num_scan_profiles);
+    } else {
+      strcpy(resp, "Error, invalid radio params");
+    }
+  } else if (memcmp(command, "scan list", 9) == 0) {
+    char* dp = resp;
+    *dp = 0;
+    for (int i = 0; i < _prefs->num_scan_profiles; i++) {
+      const ScanProfile* p = &_prefs->scan_profiles[i];
+      char freq[16], bw[16];
+      strcpy(freq, StrHelper::ftoa(p->freq));
+      strcpy(bw, StrHelper::ftoa(p->bw));
+      dp += sprintf(dp, "%s%d: %s,%s,%d,%d,0x%x", i > 0 ? "\n" : "", i + 1,
+                    freq, bw, (uint32_t)p->sf, (uint32_t)p->cr, (uint32_t)p->sync_word);
+    }
+    if (_prefs->num_scan_profiles == 0) strcpy(resp, "(no profiles)");
+  } else if (memcmp(command, "scan clear", 10) == 0) {
+    _callbacks->stopScan();
+    _prefs->num_scan_profiles = 0;
+    savePrefs();
+    strcpy(resp, "OK");
+  } else if (memcmp(command, "profile save ", 13) == 0) {
+    const char* name = &command[13];
+    int idx = findRadioProfile(name);
+    if (name[0] == 0 || strlen(name) >= RADIO_PROFILE_NAME_LEN) {
+      sprintf(resp, "Error, name must be 1-%d chars", RADIO_PROFILE_NAME_LEN - 1);
+    } else if (idx < 0 && _prefs->num_radio_profiles >= MAX_RADIO_PROFILES) {
+      sprintf(resp, "Error, max %d profiles", MAX_RADIO_PROFILES);
+    } else {
+      if (idx < 0) idx = _prefs->num_radio_profiles++;
+      RadioProfile* p = &_prefs->radio_profiles[idx];
+      packRadioPrefs(*p);
+      StrHelper::strncpy(p->name, name, sizeof(p->name));
+      savePrefs();
+      strcpy(resp, "OK");
+    }
+  } else if (memcmp(command, "profile use ", 12) == 0) {
+    int idx = findRadioProfile(&command[12]);
+    if (idx < 0) {
+      sprintf(resp, "Error, unknown profile: %s", &command[12]);
+    } else {
+      NodePrefs prev = *_prefs;
+      unpackRadioPrefs(_prefs->radio_profiles[idx]);
+      strcpy(resp, applyRadioPrefs(prev) ? "OK" : "Error, radio rejected profile");
+    }
+  } else if (memcmp(command, "profile del ", 12) == 0) {
+    int idx = findRadioProfile(&command[12]);
+    if (idx < 0) {
+      sprintf(resp, "Error, unknown profile: %s", &command[12]);
+    } else {
+      _prefs->num_radio_profiles--;
+      memmove(&_prefs->radio_profiles[idx], &_prefs->radio_profiles[idx + 1], (_prefs->num_radio_profiles - idx) * sizeof(RadioProfile));
+      savePrefs();
+      strcpy(resp, "OK");
+    }
+  } else if (memcmp(command, "profile list", 12) == 0) {
+    char* dp = resp;
+    *dp = 0;
+    for (int i = 0; i < _prefs->num_radio_profiles; i++) {
+      if (dp - resp > CMD_BUF_LEN_MAX - 100) {   // no room for a whole line
+        strcpy(dp, "\n...");
+        break;
+      }
+      const RadioProfile* p = &_prefs->radio_profiles[i];
+      char freq[16], bw[16];
+      strcpy(freq, StrHelper::ftoa(p->getFreq()));
+      strcpy(bw, StrHelper::ftoa(p->getBW()));
+      if (p->modem == MODEM_FSK) {
+        char bitrate[16], freq_dev[16];
+        strcpy(bitrate, StrHelper::ftoa(p->getBitrate()));
+        strcpy(freq_dev, StrHelper::ftoa(p->getFreqDev()));
+        dp += sprintf(dp, "%s%s: fsk,%s,%s,%s,%s,0x%x", i > 0 ? "\n" : "", p->name,
+                      freq, bitrate, freq_dev, bw, (uint32_t)p->sync_word);
+      } else {
+        dp += sprintf(dp, "%s%s: %s,%s,%d,%d,0x%x", i > 0 ? "\n" : "", p->name,
+                      freq, bw, (uint32_t)p->getSF(), (uint32_t)p->getCR(), (uint32_t)p->sync_word);
+        dp += formatLoRaOpts(dp, p->preamble, p->lora_opts, p->implicit_len, false);
+      }
+    }
+    if (_prefs->num_radio_profiles == 0) strcpy(resp, "(no profiles)");
+  } else if (memcmp(command, "scan start", 10) == 0) {
+    strcpy(resp, _callbacks->startScan() ? "OK - scanning" : "Error, no scan profiles");
+  } else if (memcmp(command, "scan stop", 9) == 0) {
+    _callbacks->stopScan();
+    strcpy(resp, "OK");
+  } else if (strcmp(command, "queue list") == 0) {
+    _callbacks->dumpQueue();
+    sprintf(resp, "   %d queued", _mesh->getQueuedCount());
+  } else if (memcmp(command, "queue cancel tag ", 17) == 0) {
+    uint32_t tag = strtoul(&command[17], NULL, 0);
+    if (tag == 0) {
+      strcpy(resp, "Error, tag must be non-zero");
+    } else {
+      sprintf(resp, "OK - %d cancelled", _mesh->cancelQueuedByTag(tag));
+    }
+  } else if (memcmp(command, "queue cancel ", 13) == 0) {
+    sprintf(resp, "OK - %d cancelled", _mesh->cancelQueued(atoi(&command[13])));
+  } else if (strcmp(command, "noise") == 0) {
+    _callbacks->dumpNoiseStats();
+    resp[0] = 0;
+  } else if (strcmp(command, "stats") == 0) {
+    _callbacks->formatStatsReply(resp);
   } else if (memcmp(command, "clear stats", 11) == 0) {
     _callbacks->clearStats();
     strcpy(resp, "(OK - stats reset)");
@@ -266,12 +592,41 @@ void CommonCLI::handleCLICommand(
       sprintf(resp, "> %d", (uint32_t) _prefs->interference_threshold);
     } else if (memcmp(config, "agc.reset.interval", 18) == 0) {
       sprintf(resp, "> %d", ((uint32_t) _prefs->agc_reset_interval) * 4);
+    } else if (memcmp(config, "lbt", 3) == 0) {
+      sprintf(resp, "> %s", _prefs->lbt_mode == LBT_MODE_CAD ? "cad" : "rssi");
+    } else if (memcmp(config, "frag", 4) == 0) {
+      _callbacks->formatFragReply(resp);
+    } else if (memcmp(config, "cutthrough", 10) == 0) {
+      sprintf(resp, "> %s", _prefs->cut_through ? "on" : "off");
+    } else if (memcmp(config, "promisc", 7) == 0) {
+      sprintf(resp, "> %s", _prefs->promiscuous ? "on" : "off");
+    } else if (memcmp(config, "recovery", 8) == 0) {
+      _callbacks->formatRecoveryReply(resp);
+    } else if (memcmp(config, "tdma", 4) == 0) {
+      char* dp = resp;
+      dp += sprintf(dp, "> %s,%u,%d,", _prefs->tdma ? "on" : "off", _prefs->tdma_frame_ms, (uint32_t) _prefs->tdma_num_slots);
+      for (int i = 0, n = 0; i < TDMA_MAX_SLOTS; i++) {
+        if (_prefs->tdma_slot_mask & (1UL << i)) dp += sprintf(dp, n++ > 0 ? "/%d" : "%d", i);
+      }
+      sprintf(dp, ",%d", (uint32_t) _prefs->tdma_guard_ms);
+    } else if (memcmp(config, "qos", 3) == 0) {
+      _callbacks->formatQoSReply(resp);
     } else if (memcmp(config, "name", 4) == 0) {
       sprintf(resp, "> %s", _prefs->node_name);
     } else if (memcmp(config, "lat", 3) == 0) {
       sprintf(resp, "> %s", StrHelper::ftoa(_prefs->node_lat));
     } else if (memcmp(config, "lon", 3) == 0) {
       sprintf(resp, "> %s", StrHelper::ftoa(_prefs->node_lon));
+    } else if (memcmp(config, "lora", 4) == 0) {
+      formatLoRaOpts(_tmp, _prefs->lora_preamble, _prefs->lora_opts, _prefs->lora_implicit_len, true);
+      sprintf(resp, "> %s", &_tmp[1]);   // skip leading ','
+    } else if (memcmp(config, "radio", 5) == 0 && _prefs->modem == MODEM_FSK) {
+      char freq[16], bitrate[16], freq_dev[16], rx_bw[16];
+      strcpy(freq, StrHelper::ftoa(_prefs->freq));
+      strcpy(bitrate, StrHelper::ftoa(_prefs->fsk_bitrate));
+      strcpy(freq_dev, StrHelper::ftoa(_prefs->fsk_freq_dev));
+      strcpy(rx_bw, StrHelper::ftoa(_prefs->fsk_rx_bw));
+      sprintf(resp, "> fsk,%s,%s,%s,%s,0x%x", freq, bitrate, freq_dev, rx_bw, (uint32_t)_prefs->sync_word);
     } else if (memcmp(config, "radio", 5) == 0) {
       char freq[16], bw[16];
       strcpy(freq, StrHelper::ftoa(_prefs->freq));
@@ -311,6 +666,117 @@ void CommonCLI::handleCLICommand(
       _prefs->interference_threshold = atoi(&config[11]);
       savePrefs();
       strcpy(resp, "OK");
+    } else if (memcmp(config, "lbt ", 4) == 0) {
+      if (strcmp(&config[4], "cad") == 0) {
+        _prefs->lbt_mode = LBT_MODE_CAD;
+        savePrefs();
+        strcpy(resp, "OK");
+      } else if (strcmp(&config[4], "rssi") == 0) {
+        _prefs->lbt_mode = LBT_MODE_RSSI;
+        savePrefs();
+        strcpy(resp, "OK");
+      } else {
+        sprintf(resp, "unknown lbt mode: %s", &config[4]);
+      }
+    } else if (memcmp(config, "frag.fec ", 9) == 0) {
+      int repairs = atoi(&config[9]);
+      if (repairs >= 0 && repairs <= FRAG_FEC_MAX_REPAIRS) {
+        _prefs->frag_fec_repairs = repairs;
+        _callbacks->setFragFEC(repairs);
+        savePrefs();
+        strcpy(resp, "OK");
+      } else {
+        sprintf(resp, "Error, repairs must be 0-%d", FRAG_FEC_MAX_REPAIRS);
+      }
+    } else if (memcmp(config, "frag.agg ", 9) == 0) {
+      int hold = atoi(&config[9]);
+      if (hold >= 0 && hold <= FRAG_AGG_MAX_HOLD_MILLIS) {
+        _prefs->frag_agg_hold = hold;
+        _callbacks->setFragAggregation(hold);
+        savePrefs();
+        strcpy(resp, "OK");
+      } else {
+        sprintf(resp, "Error, hold must be 0-%d ms", FRAG_AGG_MAX_HOLD_MILLIS);
+      }
+    } else if (memcmp(config, "frag ", 5) == 0) {
+      _prefs->frag = memcmp(&config[5], "on", 2) == 0;
+      _callbacks->setFragmentation(_prefs->frag);
+      savePrefs();
+      strcpy(resp, _prefs->frag ? "OK - every sender on this channel must also use frag" : "OK");
+    } else if (memcmp(config, "cutthrough ", 11) == 0) {
+      _prefs->cut_through = memcmp(&config[11], "on", 2) == 0;
+      savePrefs();
+      strcpy(resp, "OK");
+    } else if (memcmp(config, "promisc ", 8) == 0) {
+      _prefs->promiscuous = memcmp(&config[8], "on", 2) == 0;
+      _callbacks->setPromiscuous(_prefs->promiscuous);
+      savePrefs();
+      strcpy(resp, "OK");
+    } else if (memcmp(config, "recovery ", 9) == 0) {
+      _prefs->radio_recovery = memcmp(&config[9], "on", 2) == 0;
+      _callbacks->setRadioRecovery(_prefs->radio_recovery);
+      savePrefs();
+      strcpy(resp, "OK");
+    } else if (strcmp(config, "tdma on") == 0 || strcmp(config, "tdma off") == 0) {
+      bool enable = config[6] == 'n';
+      if (enable && !TDMASchedule::isValid(_prefs->tdma_frame_ms, _prefs->tdma_num_slots, _prefs->tdma_slot_mask, _prefs->tdma_guard_ms)) {
+        strcpy(resp, "Error, set the tdma slots first");
+      } else {
+        _prefs->tdma = enable;
+        _callbacks->setTDMA(enable, _prefs->tdma_frame_ms, _prefs->tdma_num_slots, _prefs->tdma_slot_mask, _prefs->tdma_guard_ms);
+        savePrefs();
+        strcpy(resp, "OK");
+      }
+    } else if (memcmp(config, "tdma ", 5) == 0) {
+      strcpy(_tmp, &config[5]);
+      const char *parts[4];
+      int num = mesh::Utils::parseTextParts(_tmp, parts, 4);
+      uint32_t frame_ms = num > 0 ? atol(parts[0]) : 0;
+      int num_slots     = num > 1 ? atoi(parts[1]) : 0;
+      uint16_t guard_ms = num > 3 ? atoi(parts[3]) : 0;
+      uint32_t slot_mask = 0;
+      const char* sp = num > 2 ? parts[2] : "";
+      while (*sp) {   // eg. "2/7"
+        char* end;
+        long slot = strtol(sp, &end, 10);
+        if (end == sp || slot < 0 || slot >= TDMA_MAX_SLOTS || (*end != 0 && *end != '/')) {
+          slot_mask = 0;
+          break;
+        }
+        slot_mask |= 1UL << slot;
+        sp = *end ? end + 1 : end;
+      }
+      if (num_slots > 0 && num_slots <= TDMA_MAX_SLOTS && TDMASchedule::isValid(frame_ms, num_slots, slot_mask, guard_ms)) {
+        _prefs->tdma = true;
+        _prefs->tdma_frame_ms = frame_ms;
+        _prefs->tdma_num_slots = num_slots;
+        _prefs->tdma_slot_mask = slot_mask;
+        _prefs->tdma_guard_ms = guard_ms;
+        _callbacks->setTDMA(true, frame_ms, num_slots, slot_mask, guard_ms);
+        savePrefs();
+        sprintf(resp, "OK - %u ms slots", frame_ms / num_slots);
+      } else {
+        strcpy(resp, "Error, invalid tdma params");
+      }
+    } else if (memcmp(config, "qos ", 4) == 0) {
+      strcpy(_tmp, &config[4]);
+      const char *parts[MAX_TX_CLASSES];
+      int num = mesh::Utils::parseTextParts(_tmp, parts, MAX_TX_CLASSES);
+      uint8_t weights[MAX_TX_CLASSES];
+      bool valid = num == MAX_TX_CLASSES;
+      for (int c = 0; valid && c < MAX_TX_CLASSES; c++) {
+        int w = atoi(parts[c]);
+        if (w < 1 || w > QOS_MAX_WEIGHT) valid = false;
+        weights[c] = w;
+      }
+      if (valid) {
+        memcpy(_prefs->qos_weights, weights, sizeof(weights));
+        _callbacks->setQoSWeights(weights);
+        savePrefs();
+        strcpy(resp, "OK");
+      } else {
+        sprintf(resp, "Error, need %d weights of 1-%d", MAX_TX_CLASSES, QOS_MAX_WEIGHT);
+      }
     } else if (memcmp(config, "agc.reset.interval ", 19) == 0) {
       _prefs->agc_reset_interval = atoi(&config[19]) / 4;
       savePrefs();
@@ -330,7 +796,7 @@ void CommonCLI::handleCLICommand(
       _prefs->ble_filter_dups = num > 1 ? (memcmp(parts[1], "on", 2) == 0) : true;
       _prefs->ble_max_results  = num > 2 ?  atoi(parts[2]) : 0;
       _prefs->ble_scantime = num > 3 ? atoi(parts[3]) : 0;
-      _callbacks->savePrefs();
+      savePrefs();
       _callbacks->applyBLEParams(
         true,
         _prefs->ble_active_scan,
@@ -340,6 +806,31 @@ void CommonCLI::handleCLICommand(
       );
       strcpy(resp, "OK - reboot to apply");
 
+    } else if (memcmp(config, "radio fsk,", 10) == 0) {
+      strcpy(_tmp, &config[10]);
+      const char *parts[5];
+      int num = mesh::Utils::parseTextParts(_tmp, parts, 5);
+      float freq      = num > 0 ? atof(parts[0]) : 0.0f;
+      float bitrate   = num > 1 ? atof(parts[1]) : 0.0f;
+      float freq_dev  = num > 2 ? atof(parts[2]) : 0.0f;
+      float rx_bw     = num > 3 ? atof(parts[3]) : 0.0f;
+      uint8_t sync_word  = num > 4 ? strtol(parts[4], nullptr, 16) : 0;
+      if (isValidFSKParams(freq, bitrate, freq_dev, rx_bw)) {
+        if (_callbacks->applyFSKParams(freq, bitrate, freq_dev, rx_bw, sync_word, 0)) {
+          _prefs->modem = MODEM_FSK;
+          _prefs->freq = freq;
+          _prefs->fsk_bitrate = bitrate;
+          _prefs->fsk_freq_dev = freq_dev;
+          _prefs->fsk_rx_bw = rx_bw;
+          _prefs->sync_word = sync_word;
+          savePrefs();
+          strcpy(resp, "OK");
+        } else {
+          strcpy(resp, "Error, radio rejected params (rx bandwidth?)");
+        }
+      } else {
+        strcpy(resp, "Error, invalid FSK params");
+      }
     } else if (memcmp(config, "radio ", 6) == 0) {
       strcpy(_tmp, &config[6]);
       const char *parts[5];
@@ -354,17 +845,58 @@ void CommonCLI::handleCLICommand(
           cr >= 5 && cr <= 8 &&
           bw >= 7.0f && bw <= 500.0f
       ){
+        _prefs->modem = MODEM_LORA;
         _prefs->sf = sf;
         _prefs->cr = cr;
         _prefs->freq = freq;
         _prefs->bw = bw;
         _prefs->sync_word = sync_word;
-        _callbacks->savePrefs();
+        savePrefs();
         _callbacks->applyRadioParams(freq, bw, sf, cr, sync_word);
         strcpy(resp, "OK");
       } else {
         strcpy(resp, "Error, invalid radio params");
       }
+    } else if (memcmp(config, "lora.", 5) == 0) {
+      const char* opt = &config[5];
+      NodePrefs prev = *_prefs;
+      bool valid = true;
+      if (memcmp(opt, "preamble ", 9) == 0) {
+        int n = atoi(&opt[9]);
+        valid = n >= LORA_MIN_PREAMBLE && n <= 0xFFFF;
+        if (valid) _prefs->lora_preamble = n;
+      } else if (strcmp(opt, "header explicit") == 0) {
+        _prefs->lora_opts &= ~LORA_OPT_IMPLICIT_HDR;
+      } else if (memcmp(opt, "header implicit ", 16) == 0) {
+        int len = atoi(&opt[16]);
+        valid = len > 0 && len <= 255;
+        if (valid) {
+          _prefs->lora_opts |= LORA_OPT_IMPLICIT_HDR;
+          _prefs->lora_implicit_len = len;
+        }
+      } else if (strcmp(opt, "crc on") == 0) {
+        _prefs->lora_opts &= ~LORA_OPT_NO_CRC;
+      } else if (strcmp(opt, "crc off") == 0) {
+        _prefs->lora_opts |= LORA_OPT_NO_CRC;
+      } else if (strcmp(opt, "iq normal") == 0) {
+        _prefs->lora_opts &= ~LORA_OPT_INVERT_IQ;
+      } else if (strcmp(opt, "iq inverted") == 0) {
+        _prefs->lora_opts |= LORA_OPT_INVERT_IQ;
+      } else if (strcmp(opt, "ldro auto") == 0) {
+        _prefs->lora_opts &= ~(LORA_OPT_LDRO_ON | LORA_OPT_LDRO_OFF);
+      } else if (strcmp(opt, "ldro on") == 0) {
+        _prefs->lora_opts = (_prefs->lora_opts & ~LORA_OPT_LDRO_OFF) | LORA_OPT_LDRO_ON;
+      } else if (strcmp(opt, "ldro off") == 0) {
+        _prefs->lora_opts = (_prefs->lora_opts & ~LORA_OPT_LDRO_ON) | LORA_OPT_LDRO_OFF;
+      } else {
+        valid = false;
+      }
+
+      if (!valid) {
+        sprintf(resp, "Error, invalid lora option: %s", opt);
+      } else {
+        strcpy(resp, applyRadioPrefs(prev) ? "OK" : "Error, radio rejected params");
+      }
     } else if (memcmp(config, "lat ", 4) == 0) {
       _prefs->node_lat = atof(&config[4]);
       savePrefs();
@@ -409,6 +941,10 @@ void CommonCLI::handleCLICommand(
                   "KISS port must be between 0 and 15, invalid value: %d",
                   kiss_port);
         }
+      } else if (memcmp(kiss_config, "meta ", 5) == 0) {
+        _prefs->kiss_rx_meta = memcmp(&kiss_config[5], "on", 2) == 0;
+        savePrefs();
+        strcpy(resp, "OK");
       } else {
         sprintf(resp, "unknown kiss config: %s", kiss_config);
       }
@@ -420,6 +956,7 @@ void CommonCLI::handleCLICommand(
       sprintf(resp, "unknown config: %s", config);
     }
   } else if (sender_timestamp == 0 && strcmp(command, "erase") == 0) {
+    _prefs_dirty = false;
     bool s = _callbacks->formatFileSystem();
     sprintf(resp, "File system erase: %s", s ? "OK" : "Err");
   } else if (memcmp(command, "ver", 3) == 0) {
@@ -428,9 +965,13 @@ void CommonCLI::handleCLICommand(
             _callbacks->getFirmwareVer(),
             _callbacks->getBuildDate());
   } else if (memcmp(command, "log start", 9) == 0) {
+    _prefs->log_flash = true;
+    savePrefs();
     _callbacks->setLoggingOn(true);
     strcpy(resp, "   logging on");
   } else if (memcmp(command, "log stop", 8) == 0) {
+    _prefs->log_flash = false;
+    savePrefs();
     _callbacks->setLoggingOn(false);
     strcpy(resp, "   logging off");
   } else if (memcmp(command, "log erase", 9) == 0) {
@@ -444,7 +985,7 @@ void CommonCLI::handleCLICommand(
     strcpy(resp, "   rxlog off");
   }  else if (memcmp(command, "rxlog ble on", 12) == 0) {
     _prefs->ble_enabled = true;
-    _callbacks->savePrefs();
+    savePrefs();
     _callbacks->applyBLEParams(
       true,
       _prefs->ble_active_scan,
@@ -455,7 +996,7 @@ void CommonCLI::handleCLICommand(
     strcpy(resp, "OK - reboot to apply");
   } else if (memcmp(command, "rxlog ble off", 13) == 0) {
     _prefs->ble_enabled = false;
-    _callbacks->savePrefs();
+    savePrefs();
     _callbacks->applyBLEParams(
       true,
       _prefs->ble_active_scan,
@@ -464,8 +1005,11 @@ void CommonCLI::handleCLICommand(
       _prefs->ble_scantime
     );
     strcpy(resp, "OK   rxlog ble off");
+  } else if (sender_timestamp == 0 && memcmp(command, "log bin", 7) == 0) {
+    _callbacks->dumpLogFile(true);
+    resp[0] = 0;   // raw binary records only, no trailer
   } else if (sender_timestamp == 0 && memcmp(command, "log", 3) == 0) {
-    _callbacks->dumpLogFile();
+    _callbacks->dumpLogFile(false);
     strcpy(resp, "   EOF");
   } else {
     strcpy(resp, "Unknown command");
@@ -2,6 +2,7 @@
 
 #include <Mesh.h>
 #include "KISS.h"
+#include "PCAP.h"
 
 #if defined(ESP32) || defined(RP2040_PLATFORM)
   #include <FS.h>
@@ -15,6 +16,97 @@
 
 #define CMD_BUF_LEN_MAX 500
 
+#define PREFS_FILE        "/com_prefs"
+#define PREFS_FILE_NEW    "/com_prefs.new"
+#define PREFS_MAGIC       0x53465250   // "PRFS"
+#define PREFS_VERSION     1            // bump if the meaning of existing fields change. (new fields just go on the end)
+
+#ifndef PREFS_COMMIT_DELAY_MILLIS
+  #define PREFS_COMMIT_DELAY_MILLIS  3000   // quiet period after last change, before writing to flash
+#endif
+
+struct PrefsFileHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t len;    // sizeof(NodePrefs) of firmware that wrote the file
+  uint32_t crc;    // CRC-32 of the 'len' bytes that follow
+};
+
+#define PREFS_LOAD_OK         0
+#define PREFS_LOAD_NOT_FOUND  1
+#define PREFS_LOAD_LEGACY     2
+#define PREFS_LOAD_CORRUPT    3
+
+#ifndef MAX_SCAN_PROFILES
+  #define MAX_SCAN_PROFILES  8
+#endif
+
+struct ScanProfile {
+  float freq;
+  float bw;
+  uint8_t sf;
+  uint8_t cr;
+  uint8_t sync_word;
+};
+
+#ifndef SURVEY_DEFAULT_SAMPLES
+  #define SURVEY_DEFAULT_SAMPLES  16
+#endif
+
+#define MODEM_LORA      0
+#define MODEM_FSK       1
+
+#define FSK_MIN_BITRATE     0.6f     // kbps
+#define FSK_MAX_BITRATE     300.0f
+
+// LoRa options, all clear is the default. (same bits as LORA_FLAG_* in RadioLibWrappers.h)
+#define LORA_OPT_IMPLICIT_HDR   0x01
+#define LORA_OPT_NO_CRC         0x02
+#define LORA_OPT_INVERT_IQ      0x04
+#define LORA_OPT_LDRO_ON        0x08
+#define LORA_OPT_LDRO_OFF       0x10
+#define LORA_OPT_ALL            0x1F
+
+#define LORA_MIN_PREAMBLE       6
+#ifndef LORA_DEFAULT_PREAMBLE
+  #define LORA_DEFAULT_PREAMBLE  16
+#endif
+
+#ifndef MAX_RADIO_PROFILES
+  #define MAX_RADIO_PROFILES  8
+#endif
+#define RADIO_PROFILE_NAME_LEN  8    // including null
+
+#define QOS_MAX_WEIGHT  100
+
+/**
+ * \brief  a complete set of modem settings, saved under a name. Values are stored as scaled integers
+ *         to keep the settings file small. (bandwidths to 10 Hz, bit rate to 100 bps)
+*/
+struct RadioProfile {
+  char name[RADIO_PROFILE_NAME_LEN];
+  uint32_t freq_hz;
+  uint16_t bw_10hz;          // LoRa bandwidth, or FSK receiver bandwidth
+  uint16_t bitrate_100bps;   // FSK only
+  uint16_t freq_dev_10hz;    // FSK only
+  uint16_t preamble;         // LoRa only, 0 = default
+  uint8_t modem;             // MODEM_*
+  uint8_t sf_cr;             // LoRa only, sf << 4 | cr
+  uint8_t sync_word;
+  uint8_t lora_opts;         // LORA_OPT_*
+  uint8_t implicit_len;
+
+  float getFreq() const { return freq_hz / 1000000.0f; }
+  float getBW() const { return bw_10hz / 100.0f; }
+  float getBitrate() const { return bitrate_100bps / 10.0f; }
+  float getFreqDev() const { return freq_dev_10hz / 100.0f; }
+  uint8_t getSF() const { return sf_cr >> 4; }
+  uint8_t getCR() const { return sf_cr & 0x0F; }
+};
+
+#define LBT_MODE_RSSI   0   // RSSI above noise floor + int.thresh
+#define LBT_MODE_CAD    1   // hardware Channel Activity Detection, then RSSI
+
 struct NodePrefs {  // persisted to file
     float airtime_factor;
     char node_name[32];
@@ -42,6 +134,49 @@ struct NodePrefs {  // persisted to file
     uint32_t ble_scantime;    // 10s in milliseconds
     uint8_t ble_rxPhyMask;        // BLE_GAP_LE_PHY_ANY_MASK = 0x0F
     uint8_t ble_txPhyMask;        // BLE_GAP_LE_PHY_ANY_MASK = 0x0F
+
+    bool log_flash;           // capture RX packets to flash log
+    bool kiss_rx_meta;        // send KISSVendorCmd::RxMeta frames in KISS mode
+    uint8_t lbt_mode;         // LBT_MODE_*
+
+    // RX scanner
+    uint8_t num_scan_profiles;
+    ScanProfile scan_profiles[MAX_SCAN_PROFILES];
+
+    bool promiscuous;         // also capture CRC-failed frames (logged only, never dispatched)
+
+    bool radio_recovery;      // act on stuck radio faults (re-arm -> re-init -> reboot)
+    uint32_t recovery_reboots;   // reboots done by radio recovery, survives the reboot
+
+    // FSK modem (shares 'freq' and 'sync_word' with LoRa)
+    uint8_t modem;            // MODEM_*
+    float fsk_bitrate;        // kbps
+    float fsk_freq_dev;       // kHz
+    float fsk_rx_bw;          // kHz
+
+    // LoRa options
+    uint16_t lora_preamble;   // symbols, 0 = default (16)
+    uint8_t lora_opts;        // LORA_OPT_*
+    uint8_t lora_implicit_len;   // fixed frame length, with LORA_OPT_IMPLICIT_HDR
+
+    // named radio profiles
+    uint8_t num_radio_profiles;
+    RadioProfile radio_profiles[MAX_RADIO_PROFILES];
+
+    // TDMA
+    bool tdma;                // send only in this node's slots, instead of listen-before-talk
+    uint8_t tdma_num_slots;
+    uint16_t tdma_guard_ms;
+    uint32_t tdma_frame_ms;
+    uint32_t tdma_slot_mask;  // bit N = slot N (from 0) is ours
+
+    // QoS
+    uint8_t qos_weights[MAX_TX_CLASSES];   // share of airtime for each traffic class, relative to the others
+
+    bool cut_through;         // frames from the host skip the queue when the channel is clear
+    bool frag;                // link-layer fragmentation of large host frames
+    uint8_t frag_fec_repairs; // Reed-Solomon repair fragments added to each fragmented frame
+    uint16_t frag_agg_hold;   // millis small host frames may wait to be aggregated into one packet, 0 = off
 };
 
 class CommonCLICallbacks {
@@ -52,11 +187,29 @@ public:
   virtual bool formatFileSystem() = 0;
   virtual void setLoggingOn(bool enable) = 0;
   virtual void eraseLogFile() = 0;
-  virtual void dumpLogFile() = 0;
+  virtual void dumpLogFile(bool binary) = 0;
   virtual void setTxPower(uint8_t power_dbm) = 0;
   virtual void clearStats() = 0;
+  virtual void formatStatsReply(char* reply) = 0;
+  virtual void dumpNoiseStats() = 0;
+  virtual void dumpQueue() = 0;
+  virtual void setPromiscuous(bool enable) = 0;
+  virtual void setRadioRecovery(bool enable) = 0;
+  virtual void formatRecoveryReply(char* reply) = 0;
+  virtual void setFragmentation(bool enable) = 0;
+  virtual void setFragFEC(uint8_t repairs) = 0;
+  virtual void setFragAggregation(uint16_t hold_millis) = 0;
+  virtual void formatFragReply(char* reply) = 0;
+  virtual void setTDMA(bool enable, uint32_t frame_ms, uint8_t num_slots, uint32_t slot_mask, uint16_t guard_ms) = 0;
+  virtual void setQoSWeights(const uint8_t weights[]) = 0;
+  virtual void formatQoSReply(char* reply) = 0;
   virtual void applyTempRadioParams(float freq, float bw, uint8_t sf, uint8_t cr, uint8_t sync_word, int timeout_mins) = 0;
   virtual void applyRadioParams(float freq, float bw, uint8_t sf, uint8_t cr, uint8_t sync_word) = 0;
+  virtual bool applyFSKParams(float freq, float bitrate, float freq_dev, float rx_bw, uint8_t sync_word, int timeout_mins) = 0;  // timeout_mins = 0 to keep
+  virtual bool applyPrefsRadio() = 0;   // switch radio to all the radio settings in prefs, returns false (and radio unchanged) if rejected
+  virtual int runSurvey(float start_freq, float stop_freq, float step_khz, int samples) = 0;   // returns number of bins
+  virtual bool startScan() = 0;    // returns false if there are no scan profiles
+  virtual void stopScan() = 0;
   virtual void applyBLEParams(bool enabled, bool active, bool filter_dups, uint16_t max_results, uint32_t scantime) = 0;
 };
 
@@ -70,10 +223,20 @@ class CommonCLI {
   char _tmp[80];
   char _cmd[CMD_BUF_LEN_MAX];
   KISSModem _kiss;
+  PCAPWriter _pcap;
+  bool _prefs_dirty = false;
+  unsigned long _prefs_dirty_at;
 
   mesh::RTCClock* getRTCClock() { return _rtc; }
   void savePrefs();
-  void loadPrefsInt(FILESYSTEM* _fs, const char* filename);
+  int loadPrefsFile(FILESYSTEM* _fs, const char* filename);
+  void loadPrefsLegacy(FILESYSTEM* _fs, const char* filename);
+  void sanitisePrefs();
+  static bool isValidFSKParams(float freq, float bitrate, float freq_dev, float rx_bw);
+  void packRadioPrefs(RadioProfile& p) const;
+  void unpackRadioPrefs(const RadioProfile& p);
+  bool applyRadioPrefs(const NodePrefs& prev);
+  int formatLoRaOpts(char* dest, uint16_t preamble, uint8_t opts, uint8_t implicit_len, bool all) const;
   void parseSerialCLI();
   void handleCLICommand(uint32_t sender_timestamp, const char* command, char* resp);
 
@@ -85,6 +248,8 @@ public:
 
   void loadPrefs(FILESYSTEM* _fs);
   void savePrefs(FILESYSTEM* _fs);
+  void commitPrefs();   // write any pending pref changes now
+  void loop();
   void handleSerialData();
   CLIMode getCLIMode() { return _cli_mode; };
   KISSModem* getKISSModem() { 
@@ -92,4 +257,10 @@ public:
     KISSModem* kiss = &_kiss;
     return kiss;
   };
+  PCAPWriter* getPCAPWriter() { return &_pcap; }
+
+  /**
+   * \returns  index into NodePrefs::radio_profiles, or -1 if not found
+  */
+  int findRadioProfile(const char* name) const;
 };
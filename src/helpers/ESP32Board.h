@@ -114,6 +114,11 @@ public:
     tv.tv_usec = 0;
     settimeofday(&tv, NULL);
   }
+  uint64_t getCurrentTimeMillis() override {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((uint64_t) tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+  }
 };
 
 #endif
@@ -0,0 +1,106 @@
+#include "ErasureCode.h"
+#include <string.h>
+
+uint8_t ErasureCode::gf_exp[512];
+uint8_t ErasureCode::gf_log[256];
+bool ErasureCode::ready = false;
+
+void ErasureCode::begin() {
+  if (ready) return;
+
+  uint16_t x = 1;
+  for (int i = 0; i < 255; i++) {
+    gf_exp[i] = x;
+    gf_log[x] = i;
+    x <<= 1;
+    if (x & 0x100) x ^= 0x11D;   // x^8 + x^4 + x^3 + x^2 + 1
+  }
+  for (int i = 255; i < 512; i++) {
+    gf_exp[i] = gf_exp[i - 255];   // so log[a] + log[b] needs no modulo
+  }
+  gf_log[0] = 0;   // (unused)
+  ready = true;
+}
+
+uint8_t ErasureCode::mul(uint8_t a, uint8_t b) {
+  if (a == 0 || b == 0) return 0;
+  return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+uint8_t ErasureCode::inv(uint8_t a) {
+  return gf_exp[255 - gf_log[a]];   // NOTE: a must be non-zero
+}
+
+void ErasureCode::addMul(uint8_t* dest, const uint8_t* src, uint8_t c, int len) {
+  if (c == 0) return;
+  if (c == 1) {
+    for (int i = 0; i < len; i++) dest[i] ^= src[i];
+    return;
+  }
+  const uint8_t* exp_c = &gf_exp[gf_log[c]];
+  for (int i = 0; i < len; i++) {
+    uint8_t s = src[i];
+    if (s) dest[i] ^= exp_c[gf_log[s]];
+  }
+}
+
+void ErasureCode::encode(const uint8_t* const data[], const int data_lens[], int k, int len, int j, uint8_t* dest) {
+  memset(dest, 0, len);
+  for (int i = 0; i < k; i++) {
+    addMul(dest, data[i], repairCoef(j, i), data_lens[i]);
+  }
+}
+
+bool ErasureCode::decode(int k, int len, const uint8_t rows[], const uint8_t* const in[], const int in_lens[],
+                         int num_missing, const uint8_t missing[], uint8_t* const out[]) {
+  if (k > EC_MAX_DATA) return false;
+
+  // encoding matrix rows of the symbols we have (each received symbol = row . data)
+  uint8_t m[EC_MAX_DATA][EC_MAX_DATA];
+  uint8_t minv[EC_MAX_DATA][EC_MAX_DATA];
+  for (int r = 0; r < k; r++) {
+    for (int c = 0; c < k; c++) {
+      if (rows[r] < k) {
+        m[r][c] = rows[r] == c ? 1 : 0;
+      } else {
+        m[r][c] = repairCoef(rows[r] - k, c);
+      }
+      minv[r][c] = r == c ? 1 : 0;
+    }
+  }
+
+  // invert it, Gauss-Jordan
+  for (int c = 0; c < k; c++) {
+    int p = c;
+    while (p < k && m[p][c] == 0) p++;
+    if (p == k) return false;   // singular
+    if (p != c) {
+      for (int i = 0; i < k; i++) {
+        uint8_t t = m[c][i]; m[c][i] = m[p][i]; m[p][i] = t;
+        t = minv[c][i]; minv[c][i] = minv[p][i]; minv[p][i] = t;
+      }
+    }
+    uint8_t f = inv(m[c][c]);
+    for (int i = 0; i < k; i++) {
+      m[c][i] = mul(m[c][i], f);
+      minv[c][i] = mul(minv[c][i], f);
+    }
+    for (int r = 0; r < k; r++) {
+      if (r == c || m[r][c] == 0) continue;
+      uint8_t g = m[r][c];
+      for (int i = 0; i < k; i++) {
+        m[r][i] ^= mul(g, m[c][i]);
+        minv[r][i] ^= mul(g, minv[c][i]);
+      }
+    }
+  }
+
+  // each missing data symbol is its row of the inverse . received symbols
+  for (int n = 0; n < num_missing; n++) {
+    memset(out[n], 0, len);
+    for (int r = 0; r < k; r++) {
+      addMul(out[n], in[r], minv[missing[n]][r], in_lens[r]);
+    }
+  }
+  return true;
+}
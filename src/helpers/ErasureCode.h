@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifndef EC_MAX_DATA
+  #define EC_MAX_DATA   16   // data symbols (k) in one group
+#endif
+
+/**
+ * \brief  systematic Reed-Solomon erasure code over GF(256), with a Cauchy matrix for the repair symbols,
+ *         so any k of the data and repair symbols give back the k data symbols. Table-driven (log/exp), no big buffers.
+ *         Symbols may be shorter than 'len', the missing bytes count as zeros.
+*/
+class ErasureCode {
+  static uint8_t gf_exp[512];
+  static uint8_t gf_log[256];
+  static bool ready;
+
+public:
+  /**
+   * \brief  builds the tables (once)
+  */
+  static void begin();
+
+  static uint8_t mul(uint8_t a, uint8_t b);
+  static uint8_t inv(uint8_t a);
+
+  /**
+   * \returns  coefficient of data symbol 'i' in repair symbol 'j'
+  */
+  static uint8_t repairCoef(int j, int i) { return inv((uint8_t)(255 - j) ^ (uint8_t) i); }
+
+  /**
+   * \brief  dest[] ^= c * src[]
+  */
+  static void addMul(uint8_t* dest, const uint8_t* src, uint8_t c, int len);
+
+  /**
+   * \brief  computes repair symbol 'j' (from 0)
+   * \param  data  the k data symbols, with their lengths (up to 'len')
+   * \param  dest  (OUT) 'len' bytes
+  */
+  static void encode(const uint8_t* const data[], const int data_lens[], int k, int len, int j, uint8_t* dest);
+
+  /**
+   * \brief  rebuilds missing data symbols from any k received symbols
+   * \param  rows  index of each received symbol: 0..k-1 for data, k+j for repair symbol j
+   * \param  in  the k received symbols, with their lengths (up to 'len')
+   * \param  missing  indexes of the data symbols to rebuild (none of which are in 'rows')
+   * \param  out  (OUT) 'len' bytes for each missing symbol
+   * \returns  false if the received symbols can't be decoded (eg. a row given twice)
+  */
+  static bool decode(int k, int len, const uint8_t rows[], const uint8_t* const in[], const int in_lens[],
+                     int num_missing, const uint8_t missing[], uint8_t* const out[]);
+};
@@ -0,0 +1,393 @@
+#include "Fragmenter.h"
+
+#if FRAG_MAX_SYMBOLS > FRAG_INDEX_MASK + 1
+  #error "FRAG_MAX_FRAME_LEN and FRAG_FEC_MAX_REPAIRS need more fragments than the header can number"
+#endif
+#if FRAG_MAX_FRAGMENTS > EC_MAX_DATA
+  #error "FRAG_MAX_FRAME_LEN needs more data fragments than ErasureCode can decode"
+#endif
+
+Fragmenter::Fragmenter(mesh::Dispatcher* mesh) : _mesh(mesh) {
+  _enabled = false;
+  _fec_repairs = 0;
+  _next_seq = (uint8_t) micros();   // so a restarted sender doesn't reuse the seq of frames still held by receivers
+  memset(_rx, 0, sizeof(_rx));
+  _complete = -1;
+  _agg = NULL;
+  _agg_hold = 0;
+  _agg_count = 0;
+  _agg_started = 0;
+  _frag_millis = 0;
+  resetStats();
+  ErasureCode::begin();
+}
+
+void Fragmenter::setEnabled(bool enable) {
+  _enabled = enable;
+  if (!enable) {
+    for (int i = 0; i < FRAG_MAX_REASSEMBLY; i++) {
+      release(_rx[i]);
+      _rx[i].done = false;
+    }
+    _complete = -1;
+  }
+}
+
+void Fragmenter::release(Reassembly& r) {
+  for (int i = 0; i < FRAG_MAX_SYMBOLS; i++) {
+    if (r.have_mask & (1UL << i)) _mesh->releasePacket(r.frags[i]);
+  }
+  r.have_mask = 0;
+  r.num_frags = 0;
+}
+
+int Fragmenter::split(const uint8_t* data, int len, mesh::Packet* dest[]) {
+  if (len <= 0 || len > FRAG_MAX_FRAME_LEN) return 0;
+
+  if (len + 1 <= MAX_TRANS_UNIT) {   // fits in one
+    mesh::Packet* pkt = _mesh->obtainNewPacket();
+    if (pkt == NULL) return 0;
+    pkt->payload[0] = FRAG_HDR_WHOLE;
+    memcpy(&pkt->payload[1], data, len);
+    pkt->payload_len = len + 1;
+    dest[0] = pkt;
+    return 1;
+  }
+  if (_fec_repairs > 0) return splitFEC(data, len, dest);
+
+  int n = (len + FRAG_DATA_LEN - 1) / FRAG_DATA_LEN;
+  uint8_t seq = _next_seq++;
+  for (int i = 0; i < n; i++) {
+    mesh::Packet* pkt = _mesh->obtainNewPacket();
+    if (pkt == NULL) {   // not enough for the whole frame, don't send any of it
+      while (i > 0) _mesh->releasePacket(dest[--i]);
+      return 0;
+    }
+    int offset = i * FRAG_DATA_LEN;
+    int sz = len - offset < FRAG_DATA_LEN ? len - offset : FRAG_DATA_LEN;
+    pkt->payload[0] = FRAG_HDR_FRAGMENT | (i == n - 1 ? FRAG_FLAG_LAST : 0) | i;
+    pkt->payload[1] = seq;
+    memcpy(&pkt->payload[FRAG_HDR_LEN], &data[offset], sz);
+    pkt->payload_len = FRAG_HDR_LEN + sz;
+    dest[i] = pkt;
+  }
+  n_tx_frames++;
+  return n;
+}
+
+int Fragmenter::splitFEC(const uint8_t* data, int len, mesh::Packet* dest[]) {
+  int k = (len + FRAG_FEC_DATA_LEN - 1) / FRAG_FEC_DATA_LEN;
+  int n = k + _fec_repairs;
+  uint8_t last_len = len - (k - 1) * FRAG_FEC_DATA_LEN;
+  const uint8_t* syms[FRAG_MAX_FRAGMENTS];
+  int sym_lens[FRAG_MAX_FRAGMENTS];
+
+  uint8_t seq = _next_seq++;
+  for (int i = 0; i < n; i++) {
+    mesh::Packet* pkt = _mesh->obtainNewPacket();
+    if (pkt == NULL) {
+      while (i > 0) _mesh->releasePacket(dest[--i]);
+      return 0;
+    }
+    pkt->payload[0] = FRAG_HDR_FEC | i;
+    pkt->payload[1] = seq;
+    pkt->payload[2] = k;
+    pkt->payload[3] = last_len;
+    if (i < k) {
+      syms[i] = &data[i * FRAG_FEC_DATA_LEN];
+      sym_lens[i] = i == k - 1 ? last_len : FRAG_FEC_DATA_LEN;
+      memcpy(&pkt->payload[FRAG_FEC_HDR_LEN], syms[i], sym_lens[i]);
+      pkt->payload_len = FRAG_FEC_HDR_LEN + sym_lens[i];
+    } else {
+      ErasureCode::encode(syms, sym_lens, k, FRAG_FEC_DATA_LEN, i - k, &pkt->payload[FRAG_FEC_HDR_LEN]);
+      pkt->payload_len = FRAG_FEC_HDR_LEN + FRAG_FEC_DATA_LEN;
+    }
+    dest[i] = pkt;
+  }
+  n_tx_frames++;
+  return n;
+}
+
+bool Fragmenter::readFrame(mesh::Packet* pkt, const uint8_t* data, int len) const {
+  if (len <= 0) return false;
+  if (!_enabled) {
+    return len <= MAX_TRANS_UNIT && pkt->readFrom(data, len);
+  }
+  if (len + 1 > MAX_TRANS_UNIT) return false;
+  pkt->payload[0] = FRAG_HDR_WHOLE;
+  memcpy(&pkt->payload[1], data, len);
+  pkt->payload_len = len + 1;
+  return true;
+}
+
+Fragmenter::Reassembly* Fragmenter::getSlot(uint8_t seq) {
+  Reassembly* victim = NULL;
+  Reassembly* free_slot = NULL;
+  for (int i = 0; i < FRAG_MAX_REASSEMBLY; i++) {
+    Reassembly* r = &_rx[i];
+    if (r->have_mask == 0 && !r->done) {
+      if (free_slot == NULL) free_slot = r;
+    } else if (r->seq == seq) {
+      return r;
+    } else if (victim == NULL || (r->done && !victim->done)
+          || (r->done == victim->done && r->started - victim->started > 0x7FFFFFFF)) {   // done ones first, then the earliest
+      victim = r;
+    }
+  }
+  if (free_slot) return free_slot;
+
+  if (!victim->done) n_rx_dropped++;   // all busy, give up on the oldest
+  release(*victim);
+  victim->done = false;
+  return victim;
+}
+
+// whether a fragment belongs with those already held (a different one at an index we have means the seq was reused)
+bool Fragmenter::fits(const Reassembly& r, int idx, bool fec, bool last, uint8_t k, uint8_t last_len) const {
+  if (r.have_mask == 0) return true;
+  if (r.have_mask & (1UL << idx)) return false;
+  if (fec != r.fec) return false;
+  if (fec) return k == r.num_frags && last_len == r.last_len;
+  if (r.num_frags > 0 && idx >= r.num_frags) return false;
+  return !last || (r.have_mask >> idx) == 0;
+}
+
+bool Fragmenter::aggregate(const uint8_t* data, int len, uint8_t tx_class, uint32_t host_tag, unsigned long now, mesh::Packet*& ready) {
+  ready = NULL;
+  if (!_enabled || _agg_hold == 0 || len <= 0 || len > FRAG_AGG_MAX_FRAME_LEN) return false;
+
+  if (_agg && (_agg->tx_class != tx_class || _agg->host_tag != host_tag || _agg->payload_len + 1 + len > MAX_TRANS_UNIT)) {
+    ready = takeAggregate(now, true);   // send what we have, and start a new one
+  }
+  if (_agg == NULL) {
+    _agg = _mesh->obtainNewPacket();
+    if (_agg == NULL) return false;
+    _agg->payload[0] = FRAG_HDR_AGGREGATE;
+    _agg->payload_len = 1;
+    _agg->tx_class = tx_class;
+    _agg->host_tag = host_tag;
+    _agg_count = 0;
+    _agg_started = now;
+  }
+  _agg->payload[_agg->payload_len++] = len;
+  memcpy(&_agg->payload[_agg->payload_len], data, len);
+  _agg->payload_len += len;
+  _agg_count++;
+  return true;
+}
+
+mesh::Packet* Fragmenter::takeAggregate(unsigned long now, bool force) {
+  if (_agg == NULL) return NULL;
+  bool full = _agg->payload_len + 2 > MAX_TRANS_UNIT;   // no room for even a 1 byte frame
+  if (!force && !full && now - _agg_started < _agg_hold) return NULL;
+
+  mesh::Packet* pkt = _agg;
+  _agg = NULL;
+  if (_agg_count == 1) {   // nothing to aggregate with, send it as a whole frame
+    pkt->payload[0] = FRAG_HDR_WHOLE;
+    pkt->payload_len--;
+    memmove(&pkt->payload[1], &pkt->payload[2], pkt->payload_len - 1);
+  } else {
+    n_agg_frames += _agg_count;
+    n_agg_packets++;
+  }
+  return pkt;
+}
+
+int Fragmenter::nextInAggregate(const uint8_t* raw, int len, int& pos, const uint8_t*& frame) {
+  if (pos == 0) pos = 1;   // skip the header
+  if (pos >= len) return 0;
+  int frame_len = raw[pos];
+  if (frame_len == 0 || pos + 1 + frame_len > len) return 0;
+  frame = &raw[pos + 1];
+  pos += 1 + frame_len;
+  return frame_len;
+}
+
+bool Fragmenter::isAggregate(const uint8_t* raw, int len) {
+  if (len < 2 || raw[0] != FRAG_HDR_AGGREGATE) return false;
+  int pos = 0;
+  const uint8_t* frame;
+  while (nextInAggregate(raw, len, pos, frame) > 0) ;
+  return pos == len;   // lengths add up exactly
+}
+
+int Fragmenter::onRecv(const uint8_t* raw, int len, unsigned long now) {
+  if (len >= 2 && raw[0] == FRAG_HDR_WHOLE) return FRAG_RX_WHOLE;
+  if (len >= 2 && raw[0] == FRAG_HDR_AGGREGATE) {
+    if (isAggregate(raw, len)) return FRAG_RX_AGGREGATE;
+    n_rx_dropped++;
+    return FRAG_RX_DROPPED;
+  }
+
+  uint8_t type = raw[0] & FRAG_HDR_TYPE_MASK;
+  bool fec = type == FRAG_HDR_FEC;
+  int hdr_len = fec ? FRAG_FEC_HDR_LEN : FRAG_HDR_LEN;
+  if ((type != FRAG_HDR_FRAGMENT && !fec) || len <= hdr_len) return FRAG_RX_RAW;
+
+  int idx = raw[0] & FRAG_INDEX_MASK;
+  uint8_t seq = raw[1];
+  bool last = false;
+  uint8_t k = 0, last_len = 0;
+  bool valid;
+  if (fec) {
+    k = raw[2];
+    last_len = raw[3];
+    int expect_len = idx == k - 1 ? last_len : FRAG_FEC_DATA_LEN;
+    valid = k >= 2 && k <= FRAG_MAX_FRAGMENTS && idx < k + FRAG_FEC_MAX_REPAIRS
+          && last_len > 0 && last_len <= FRAG_FEC_DATA_LEN && len - hdr_len == expect_len;
+  } else {
+    last = (raw[0] & FRAG_FLAG_LAST) != 0;
+    valid = idx < FRAG_MAX_FRAGMENTS;
+  }
+  if (!valid) {
+    n_rx_dropped++;
+    return FRAG_RX_DROPPED;
+  }
+
+  Reassembly* r = getSlot(seq);
+  if (r->done) return FRAG_RX_LATE;
+  if (r->have_mask & (1UL << idx)) {
+    const mesh::Packet* held = r->frags[idx];
+    if (held->payload_len == len - hdr_len && memcmp(held->payload, &raw[hdr_len], len - hdr_len) == 0) {
+      return FRAG_RX_HELD;   // one we already have (eg. heard twice), nothing to do
+    }
+  }
+  if (!fits(*r, idx, fec, last, k, last_len)) {
+    // a new frame has reused the seq. Start over with this one
+    n_rx_dropped++;
+    release(*r);
+  }
+
+  mesh::Packet* pkt = _mesh->obtainNewPacket();
+  if (pkt == NULL) {
+    n_rx_dropped++;
+    return FRAG_RX_DROPPED;
+  }
+  memcpy(pkt->payload, &raw[hdr_len], len - hdr_len);
+  pkt->payload_len = len - hdr_len;
+
+  if (r->have_mask == 0) {
+    r->seq = seq;
+    r->started = now;
+    r->fec = fec;
+    r->num_frags = k;   // (0 for plain fragments, until the last one)
+    r->last_len = last_len;
+  }
+  r->frags[idx] = pkt;
+  r->have_mask |= 1UL << idx;
+  if (last) r->num_frags = idx + 1;
+
+  return checkComplete(*r);
+}
+
+int Fragmenter::checkComplete(Reassembly& r) {
+  if (r.num_frags == 0) return FRAG_RX_HELD;
+
+  uint32_t data_mask = (1UL << r.num_frags) - 1;
+  if ((r.have_mask & data_mask) != data_mask) {
+    if (!r.fec) return FRAG_RX_HELD;
+
+    int count = 0;
+    for (uint32_t m = r.have_mask; m; m &= m - 1) count++;
+    if (count < r.num_frags) return FRAG_RX_HELD;
+
+    if (!recover(r)) {
+      n_rx_dropped++;
+      release(r);
+      return FRAG_RX_DROPPED;
+    }
+    n_rx_recovered++;
+  }
+
+  for (int i = r.num_frags; i < FRAG_MAX_SYMBOLS; i++) {   // repair fragments aren't needed now
+    if (r.have_mask & (1UL << i)) _mesh->releasePacket(r.frags[i]);
+  }
+  r.have_mask &= data_mask;
+
+  _complete = &r - _rx;
+  n_rx_frames++;
+  return FRAG_RX_COMPLETE;
+}
+
+// rebuilds the missing data fragments from k of those held
+bool Fragmenter::recover(Reassembly& r) {
+  int k = r.num_frags;
+  uint8_t rows[FRAG_MAX_FRAGMENTS];
+  const uint8_t* in[FRAG_MAX_FRAGMENTS];
+  int in_lens[FRAG_MAX_FRAGMENTS];
+  int num_in = 0;
+  for (int i = 0; i < FRAG_MAX_SYMBOLS && num_in < k; i++) {
+    if ((r.have_mask & (1UL << i)) == 0) continue;
+    rows[num_in] = i;
+    in[num_in] = r.frags[i]->payload;
+    in_lens[num_in] = r.frags[i]->payload_len;
+    num_in++;
+  }
+
+  uint8_t missing[FRAG_MAX_FRAGMENTS];
+  mesh::Packet* out_pkts[FRAG_MAX_FRAGMENTS];
+  uint8_t* out[FRAG_MAX_FRAGMENTS];
+  int num_missing = 0;
+  bool ok = true;
+  for (int i = 0; i < k && ok; i++) {
+    if (r.have_mask & (1UL << i)) continue;
+    mesh::Packet* pkt = _mesh->obtainNewPacket();
+    if (pkt == NULL) {
+      ok = false;
+    } else {
+      missing[num_missing] = i;
+      out_pkts[num_missing] = pkt;
+      out[num_missing] = pkt->payload;
+      num_missing++;
+    }
+  }
+  ok = ok && ErasureCode::decode(k, FRAG_FEC_DATA_LEN, rows, in, in_lens, num_missing, missing, out);
+  if (!ok) {
+    for (int n = 0; n < num_missing; n++) _mesh->releasePacket(out_pkts[n]);
+    return false;
+  }
+
+  for (int n = 0; n < num_missing; n++) {
+    int i = missing[n];
+    out_pkts[n]->payload_len = i == k - 1 ? r.last_len : FRAG_FEC_DATA_LEN;
+    r.frags[i] = out_pkts[n];
+    r.have_mask |= 1UL << i;
+  }
+  return true;
+}
+
+int Fragmenter::getNumChunks() const {
+  return _complete >= 0 ? _rx[_complete].num_frags : 0;
+}
+
+const uint8_t* Fragmenter::getChunk(int i, int& len) const {
+  const mesh::Packet* pkt = _rx[_complete].frags[i];
+  len = pkt->payload_len;
+  return pkt->payload;
+}
+
+void Fragmenter::releaseComplete() {
+  if (_complete < 0) return;
+  release(_rx[_complete]);
+  _rx[_complete].done = true;
+  _complete = -1;
+}
+
+// fixed allowance, plus the airtime of every fragment the frame can have
+uint32_t Fragmenter::getTimeout(const Reassembly& r) const {
+  int n = r.num_frags ? r.num_frags : FRAG_MAX_FRAGMENTS;   // (plain fragments: unknown until the last)
+  if (r.fec) n += FRAG_FEC_MAX_REPAIRS;
+  return FRAG_REASSEMBLY_TIMEOUT_MILLIS + n * _frag_millis;
+}
+
+void Fragmenter::loop(unsigned long now) {
+  for (int i = 0; i < FRAG_MAX_REASSEMBLY; i++) {
+    Reassembly& r = _rx[i];
+    if ((r.have_mask != 0 || r.done) && i != _complete && now - r.started >= getTimeout(r)) {
+      if (!r.done) n_rx_timeouts++;
+      release(r);
+      r.done = false;
+    }
+  }
+}
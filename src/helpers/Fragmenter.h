@@ -0,0 +1,168 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Dispatcher.h>
+#include <helpers/ErasureCode.h>
+
+#ifndef FRAG_MAX_FRAME_LEN
+  #define FRAG_MAX_FRAME_LEN    2048   // largest host frame
+#endif
+#ifndef FRAG_MAX_REASSEMBLY
+  #define FRAG_MAX_REASSEMBLY   2      // frames being reassembled at once
+#endif
+#ifndef FRAG_REASSEMBLY_TIMEOUT_MILLIS
+  #define FRAG_REASSEMBLY_TIMEOUT_MILLIS  60000   // from the first fragment heard, plus the airtime of all the frame's fragments
+#endif
+#ifndef FRAG_FEC_MAX_REPAIRS
+  #define FRAG_FEC_MAX_REPAIRS  8
+#endif
+#ifndef FRAG_AGG_MAX_FRAME_LEN
+  #define FRAG_AGG_MAX_FRAME_LEN  128   // larger host frames are never aggregated
+#endif
+#define FRAG_AGG_MAX_HOLD_MILLIS  5000
+
+// link-layer header, first byte of every packet on air while fragmentation is on. There is no marker,
+// so it only works on a channel where every sender uses it: other packets would be misread.
+#define FRAG_HDR_WHOLE        0x00   // [0x00][data...]
+#define FRAG_HDR_FRAGMENT     0x40   // [0x40 | last | index][seq][data...]
+#define FRAG_HDR_FEC          0x80   // [0x80 | index][seq][k][last len][data, or repair for index >= k...]
+#define FRAG_HDR_AGGREGATE    0xC0   // [0xC0][len][frame][len][frame]...
+#define FRAG_HDR_TYPE_MASK    0xC0
+#define FRAG_FLAG_LAST        0x20
+#define FRAG_INDEX_MASK       0x1F
+#define FRAG_HDR_LEN          2
+#define FRAG_FEC_HDR_LEN      4
+
+#define FRAG_DATA_LEN         (MAX_TRANS_UNIT - FRAG_HDR_LEN)
+#define FRAG_FEC_DATA_LEN     (MAX_TRANS_UNIT - FRAG_FEC_HDR_LEN)   // also the length of repair fragments
+#define FRAG_MAX_FRAGMENTS    ((FRAG_MAX_FRAME_LEN + FRAG_FEC_DATA_LEN - 1) / FRAG_FEC_DATA_LEN)   // data fragments, either way
+#define FRAG_MAX_SYMBOLS      (FRAG_MAX_FRAGMENTS + FRAG_FEC_MAX_REPAIRS)
+
+// onRecv() results
+#define FRAG_RX_RAW        0   // no link-layer header, pass on as is
+#define FRAG_RX_WHOLE      1   // unfragmented, the data follows the header byte
+#define FRAG_RX_HELD       2   // fragment held until the rest arrive
+#define FRAG_RX_COMPLETE   3   // that was the last missing fragment, see getChunk()
+#define FRAG_RX_DROPPED    4   // fragment not usable (or no packet free to hold it)
+#define FRAG_RX_LATE       5   // belongs to a frame already passed on (eg. a repair fragment not needed)
+#define FRAG_RX_AGGREGATE  6   // several frames, see nextInAggregate()
+
+/**
+ * \brief  optional link-layer fragmentation of host frames larger than one packet. Fragments are sent
+ *         in order as normal queued packets, and the receiver holds them in packets from the pool
+ *         until the frame is complete, or times out.
+ *         With FEC repairs set, the data fragments are followed by that many Reed-Solomon repair fragments,
+ *         and any k of them give back a frame of k data fragments.
+ *         With an aggregation hold time set, small frames are instead collected into one packet, sent when
+ *         full or once the first has waited the hold time.
+*/
+class Fragmenter {
+  struct Reassembly {
+    mesh::Packet* frags[FRAG_MAX_SYMBOLS];   // fragment data, without the header
+    uint32_t have_mask;     // 0 (and not done) = slot free
+    uint8_t seq;
+    uint8_t num_frags;      // data fragments, 0 until known
+    bool fec;
+    uint8_t last_len;       // (FEC) length of the last data fragment
+    bool done;              // passed on, kept until the timeout to ignore any stragglers
+    unsigned long started;
+  };
+
+  mesh::Dispatcher* _mesh;
+  bool _enabled;
+  uint8_t _fec_repairs;
+  uint8_t _next_seq;
+  Reassembly _rx[FRAG_MAX_REASSEMBLY];
+  int _complete;    // _rx index of the frame just completed, or -1
+  mesh::Packet* _agg;   // aggregate being collected, NULL if none
+  uint16_t _agg_hold;
+  uint32_t _frag_millis;
+  uint8_t _agg_count;
+  unsigned long _agg_started;
+  uint32_t n_tx_frames, n_rx_frames, n_rx_timeouts, n_rx_dropped, n_rx_recovered;
+  uint32_t n_agg_frames, n_agg_packets;
+
+  void release(Reassembly& r);
+  Reassembly* getSlot(uint8_t seq);
+  bool fits(const Reassembly& r, int idx, bool fec, bool last, uint8_t k, uint8_t last_len) const;
+  int checkComplete(Reassembly& r);
+  bool recover(Reassembly& r);
+  int splitFEC(const uint8_t* data, int len, mesh::Packet* dest[]);
+  uint32_t getTimeout(const Reassembly& r) const;
+
+public:
+  Fragmenter(mesh::Dispatcher* mesh);
+
+  void setEnabled(bool enable);
+  bool isEnabled() const { return _enabled; }
+  void setFECRepairs(uint8_t repairs) { _fec_repairs = repairs <= FRAG_FEC_MAX_REPAIRS ? repairs : FRAG_FEC_MAX_REPAIRS; }
+  uint8_t getFECRepairs() const { return _fec_repairs; }
+  void setAggHold(uint16_t hold_millis) { _agg_hold = hold_millis; }   // 0 = no aggregation
+  uint16_t getAggHold() const { return _agg_hold; }
+
+  /**
+   * \brief  time a full fragment takes on air, including any airtime budget silence after it.
+   *         Reassembly timeouts allow this much for each fragment the frame can have.
+  */
+  void setFragAirtime(uint32_t millis) { _frag_millis = millis; }
+
+  /**
+   * \brief  turns a host frame into packets to send, with link-layer headers
+   * \param  dest  (OUT) the packets, in the order to send them (up to FRAG_MAX_SYMBOLS)
+   * \returns  number of packets, 0 if the frame is too long or the pool ran out (nothing is then held)
+  */
+  int split(const uint8_t* data, int len, mesh::Packet* dest[]);
+
+  /**
+   * \brief  reads a host frame that must go in one packet, adding the whole frame header when fragmentation is on
+   * \returns  false if it doesn't fit
+  */
+  bool readFrame(mesh::Packet* pkt, const uint8_t* data, int len) const;
+
+  /**
+   * \brief  adds a small host frame to the aggregate being collected. Only frames of the same class and tag go together.
+   * \param  ready  (OUT) an aggregate to send now (the previous one, if this frame couldn't join it), or NULL
+   * \returns  false if the frame isn't aggregated (off, or too big), the caller sends it as usual
+  */
+  bool aggregate(const uint8_t* data, int len, uint8_t tx_class, uint32_t host_tag, unsigned long now, mesh::Packet*& ready);
+
+  /**
+   * \returns  the aggregate to send, once its hold time is up (or any, if 'force'), else NULL
+  */
+  mesh::Packet* takeAggregate(unsigned long now, bool force=false);
+
+  /**
+   * \brief  steps through the frames of a received aggregate (FRAG_RX_AGGREGATE)
+   * \param  pos  (IN/OUT) 0 for the first frame
+   * \returns  length of the next frame, 0 when there are no more
+  */
+  static int nextInAggregate(const uint8_t* raw, int len, int& pos, const uint8_t*& frame);
+  static bool isAggregate(const uint8_t* raw, int len);
+
+  /**
+   * \brief  a received packet (with a good CRC)
+   * \returns  one of FRAG_RX_*
+  */
+  int onRecv(const uint8_t* raw, int len, unsigned long now);
+
+  /**
+   * \brief  the pieces of the frame completed by the last onRecv(), in order. Call releaseComplete() when done.
+  */
+  int getNumChunks() const;
+  const uint8_t* getChunk(int i, int& len) const;
+  void releaseComplete();
+
+  /**
+   * \brief  call regularly, to drop frames that have timed out
+  */
+  void loop(unsigned long now);
+
+  void resetStats() { n_tx_frames = n_rx_frames = n_rx_timeouts = n_rx_dropped = n_rx_recovered = n_agg_frames = n_agg_packets = 0; }
+  uint32_t getNumTxFrames() const { return n_tx_frames; }   // fragmented frames only
+  uint32_t getNumRxFrames() const { return n_rx_frames; }
+  uint32_t getNumRxTimeouts() const { return n_rx_timeouts; }
+  uint32_t getNumRxDropped() const { return n_rx_dropped; }
+  uint32_t getNumRxRecovered() const { return n_rx_recovered; }   // frames that needed repair fragments
+  uint32_t getNumAggFrames() const { return n_agg_frames; }     // host frames sent in aggregates
+  uint32_t getNumAggPackets() const { return n_agg_packets; }   // the aggregates they went in
+};
@@ -130,6 +130,7 @@ void KISSModem::handleKISSCommand(
     switch (kiss_cmd) {
       case KISSCmd::Return:
         _cmd[0] = 0; // reset command buffer
+        _host_tag = 0;
         *_cli_mode = CLIMode::CLI; // return to CLI mode
         Serial.println("  -> Exiting KISS mode and returning to CLI mode.");
         return;
@@ -143,13 +144,114 @@ void KISSModem::handleKISSCommand(
         // TX delay is specified in 10ms units
         if (kiss_data_len > 0) _txdelay = atoi(&kiss_data[0]) * 10;
         break;
+      case KISSCmd::Vendor:
+        if (kiss_data_len > 0 && _vendor) {
+          _vendor->onKISSVendorCmd(reinterpret_cast<const uint8_t*>(kiss_data), kiss_data_len);
+        }
+        break;
       case KISSCmd::Data:
         if (kiss_data_len == 0) break;
-        const uint8_t* tx_buf = reinterpret_cast<const uint8_t*>(kiss_data);
-        mesh::Packet* pkt = _mesh->obtainNewPacket();
-        pkt->readFrom(tx_buf, kiss_data_len);
-        _mesh->sendPacket(pkt, 1, _txdelay);
+        queueFrame(reinterpret_cast<const uint8_t*>(kiss_data), kiss_data_len, 0);
         break;
     }
   }
-}
\ No newline at end of file
+}
+
+// a host frame, split into fragments (or aggregated with other small ones) when fragmentation is on
+void KISSModem::queueFrame(const uint8_t* data, uint16_t len, uint8_t tx_class) {
+  mesh::Packet* pkts[FRAG_MAX_SYMBOLS];
+  int n = 0;
+  if (_frag && _frag->isEnabled()) {
+    mesh::Packet* ready;
+    bool held = _frag->aggregate(data, len, tx_class, _host_tag, millis(), ready);
+    if (ready) sendFrame(ready);
+    if (held) return;
+
+    flushAggregate();   // keep host order
+    n = _frag->split(data, len, pkts);
+  } else if (len <= MAX_TRANS_UNIT && (pkts[0] = _mesh->obtainNewPacket()) != NULL) {
+    if (pkts[0]->readFrom(data, len)) n = 1;
+    else _mesh->releasePacket(pkts[0]);
+  }
+  if (n == 0) {
+    MESH_DEBUG_PRINTLN("KISSModem: frame too long, or no packets free, len=%d", (uint32_t) len);
+    return;
+  }
+  for (int i = 0; i < n; i++) {
+    pkts[i]->tx_class = tx_class;
+    pkts[i]->host_tag = _host_tag;
+    sendFrame(pkts[i]);
+  }
+}
+
+void KISSModem::queueFrame(const uint8_t* data, uint16_t len, const mesh::TxOverrides& ovr) {
+  flushAggregate();   // keep host order
+  mesh::Packet* pkt = _mesh->obtainNewPacket();
+  if (pkt == NULL) return;
+  if (!readFrame(pkt, data, len)) {
+    _mesh->releasePacket(pkt);
+    return;
+  }
+  pkt->tx_ovr = ovr;
+  pkt->host_tag = _host_tag;
+  sendFrame(pkt);
+}
+
+bool KISSModem::readFrame(mesh::Packet* pkt, const uint8_t* data, uint16_t len) {
+  if (_frag) return _frag->readFrame(pkt, data, len);
+  return len <= MAX_TRANS_UNIT && pkt->readFrom(data, len);
+}
+
+void KISSModem::flushAggregate() {
+  mesh::Packet* pkt = _frag ? _frag->takeAggregate(millis(), true) : NULL;
+  if (pkt) sendFrame(pkt);
+}
+
+void KISSModem::loop() {
+  mesh::Packet* pkt = _frag ? _frag->takeAggregate(millis()) : NULL;   // once its hold time is up
+  if (pkt) sendFrame(pkt);
+}
+
+void KISSModem::sendFrame(mesh::Packet* pkt) {
+  if (_txdelay == 0) {
+    _mesh->sendPacketNow(pkt, 1);   // may start TX right away
+  } else {
+    _mesh->sendPacket(pkt, 1, _txdelay);
+  }
+}
+
+void KISSModem::writeFrameStart(const KISSCmd cmd) {
+  uint8_t hdr[2];
+  hdr[0] = KISSFrame::FEND;
+  hdr[1] = ((_port << 4) & KISS_MASK_PORT) | (cmd & KISS_MASK_CMD);
+  Serial.write(hdr, 2);
+}
+
+void KISSModem::writeFrameData(const uint8_t* data, int len) {
+  uint8_t buf[64];
+  int n = 0;
+  for (int i = 0; i < len; i++) {
+    if (n + 2 > sizeof(buf)) {
+      Serial.write(buf, n);
+      n = 0;
+    }
+    switch (data[i]) {
+      case KISSFrame::FEND:
+        buf[n++] = KISSFrame::FESC;
+        buf[n++] = KISSFrame::TFEND;
+        break;
+      case KISSFrame::FESC:
+        buf[n++] = KISSFrame::FESC;
+        buf[n++] = KISSFrame::TFESC;
+        break;
+      default:
+        buf[n++] = data[i];
+        break;
+    }
+  }
+  if (n > 0) Serial.write(buf, n);
+}
+
+void KISSModem::writeFrameEnd() {
+  Serial.write((uint8_t) KISSFrame::FEND);
+}
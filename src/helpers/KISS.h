@@ -2,10 +2,12 @@
 
 #include <Arduino.h>
 #include <Mesh.h>
+#include <helpers/Fragmenter.h>
 
-enum CLIMode { CLI, KISS };
+enum CLIMode { CLI, KISS, PCAP };
 
 #define CMD_BUF_LEN_MAX 500
+#define KISS_BUF_LEN_MAX  (FRAG_MAX_FRAME_LEN + 16)   // a host frame, with the KISS and vendor frame headers
 
 // KISS Definitions
 #define KISS_MASK_PORT   0xF0
@@ -29,6 +31,49 @@ enum KISSCmd: uint8_t {
   Return = 0xF
 };
 
+// first byte of a KISSCmd::Vendor frame's data
+enum KISSVendorCmd: uint8_t {
+  RxMeta = 0x01,      // radio -> host, sent just ahead of the Data frame it describes
+  Survey = 0x02,      // host -> radio: run RSSI sweep,  radio -> host: sweep results
+  SetRadio = 0x03,    // host -> radio: switch modem/params (not persisted),  radio -> host: result
+  UseProfile = 0x04,  // host -> radio: switch to a named radio profile (not persisted),  radio -> host: result
+  TxOverride = 0x05,  // host -> radio: a Data frame, with radio settings for that frame only
+  TimedTx = 0x06,     // host -> radio: a Data frame to send at an exact RTC time,  radio -> host: TX report
+  Queue = 0x07,       // host -> radio: list/cancel queued frames,  radio -> host: result
+  ClassTx = 0x08,     // host -> radio: a Data frame, in the given traffic class
+  QoS = 0x09,         // host -> radio: request per class stats,  radio -> host: stats
+  HostTag = 0x0A,     // host -> radio: tag for the frames that follow, to cancel them by
+};
+
+// KISSVendorCmd::Queue operations
+#define KISS_QUEUE_LIST           0x00
+#define KISS_QUEUE_CANCEL_ID      0x01
+#define KISS_QUEUE_CANCEL_TAG     0x02
+
+#define KISS_QUEUE_ENTRY_LEN      16
+#ifndef KISS_QUEUE_MAX_ENTRIES
+  #define KISS_QUEUE_MAX_ENTRIES  32
+#endif
+
+#define KISS_SET_RADIO_LORA_LEN   14
+#define KISS_SET_RADIO_LORA_EXT_LEN   17   // with preamble, options, implicit len
+#define KISS_SET_RADIO_FSK_LEN    19
+
+#define KISS_TX_OVERRIDE_HDR_LEN  14   // ahead of the frame data
+#define KISS_TIMED_TX_HDR_LEN     13
+#define KISS_CLASS_TX_HDR_LEN     2
+#define KISS_HOST_TAG_LEN         5
+#define KISS_QOS_ENTRY_LEN        11
+
+#define TIMED_TX_REJECTED         3    // TX report status, for a frame that couldn't be queued (in addition to TIMED_TX_*)
+#ifndef TIMED_TX_MAX_AHEAD_MILLIS
+  #define TIMED_TX_MAX_AHEAD_MILLIS  600000   // 10 mins
+#endif
+
+#define KISS_RX_META_LEN  24
+
+#define KISS_RX_META_FLAG_CRC_OK  0x01
+
 enum KISSPort: uint8_t {
   LoRa_Port = 0x0,
   GPS_Port = 0x1,
@@ -38,31 +83,67 @@ enum KISSPort: uint8_t {
   None = 0xff
 };
 
+/**
+ * \brief  handler for KISSCmd::Vendor frames from the host (first data byte is the KISSVendorCmd)
+*/
+class KISSVendorHandler {
+public:
+  virtual void onKISSVendorCmd(const uint8_t* data, uint16_t len) = 0;
+};
+
 class KISSModem {
   uint16_t _len;
   bool _esc;
   uint32_t _txdelay;
   KISSPort _port;
-  char _cmd[CMD_BUF_LEN_MAX];
+  char _cmd[KISS_BUF_LEN_MAX];
 
   mesh::Mesh* _mesh;
   CLIMode* _cli_mode;
+  KISSVendorHandler* _vendor;
+  Fragmenter* _frag;
+  uint32_t _host_tag;   // for frames from the host, 0 = none
+
+  void flushAggregate();
 
   public:
     KISSModem(CLIMode* cli_mode, mesh::Mesh* mesh) : _cli_mode(cli_mode), _mesh(mesh) {
         _len = 0;
         _esc = false;
         _txdelay = 0;
+        _vendor = NULL;
+        _frag = NULL;
+        _host_tag = 0;
     }
+    void setVendorHandler(KISSVendorHandler* handler) { _vendor = handler; }
+    void setFragmenter(Fragmenter* frag) { _frag = frag; }
+    void setHostTag(uint32_t tag) { _host_tag = tag; }   // Packet::host_tag of the frames queued from now on
     KISSPort getPort() { return _port; };
     void setPort(KISSPort port) { _port = port; };
     void reset() {_len = 0; };
     void parseSerialKISS();
+    void loop();
     void handleKISSCommand(uint32_t sender_timestamp, const char* kiss_data, uint16_t len);
+    /**
+     * \brief  queues a frame from the host, split into fragments (or aggregated with other small ones) when
+     *         fragmentation is on
+    */
+    void queueFrame(const uint8_t* data, uint16_t len, uint8_t tx_class=0);
+    /**
+     * \brief  queues a frame from the host that must go in one packet, with the given radio settings
+    */
+    void queueFrame(const uint8_t* data, uint16_t len, const mesh::TxOverrides& ovr);
+    void sendFrame(mesh::Packet* pkt);
+    bool readFrame(mesh::Packet* pkt, const uint8_t* data, uint16_t len);
     uint16_t encodeKISSFrame(
       const KISSCmd cmd, 
       const uint8_t* data, const int data_len, 
       uint8_t* kiss_buf, const int kiss_buf_size,
       const KISSPort port = KISSPort::None
     ); // returns the size/length of the encoded data/KISS frame
+
+    // write a KISS frame straight to Serial, in pieces (eg. too big to encode in one buffer)
+    void writeFrameStart(const KISSCmd cmd);
+    void writeFrameData(const uint8_t* data, int len);
+    void writeFrameEnd();
 };
@@ -0,0 +1,65 @@
+#include "NoiseFloorEstimator.h"
+#include <math.h>
+
+NoiseFloorEstimator::NoiseFloorEstimator() {
+  memset(_channels, 0, sizeof(_channels));
+  _cur = NULL;
+}
+
+void NoiseFloorEstimator::setChannel(float freq) {
+  NoiseChannel* lru = &_channels[0];
+  for (int i = 0; i < NOISE_MAX_CHANNELS; i++) {
+    NoiseChannel* ch = &_channels[i];
+    if (ch->freq != 0 && fabsf(ch->freq - freq) < 0.001f) {   // within 1 kHz
+      _cur = ch;
+      _cur->last_used = millis();
+      return;
+    }
+    if (ch->freq == 0 || (lru->freq != 0 && ch->last_used < lru->last_used)) lru = ch;
+  }
+
+  // start fresh state for new channel
+  memset(lru, 0, sizeof(*lru));
+  lru->freq = freq;
+  lru->last_used = lru->history_at = millis();
+  _cur = lru;
+}
+
+void NoiseFloorEstimator::decay(NoiseChannel& ch) {
+  ch.total = 0;
+  for (int i = 0; i < NOISE_HIST_BINS; i++) {
+    ch.bins[i] -= ch.bins[i] >> 4;
+    ch.total += ch.bins[i];
+  }
+  ch.since_decay = 0;
+}
+
+void NoiseFloorEstimator::addSample(int rssi) {
+  if (_cur == NULL) return;
+
+  int i = constrain(rssi - NOISE_HIST_MIN_DBM, 0, NOISE_HIST_BINS - 1);
+  _cur->bins[i] += NOISE_SAMPLE_WEIGHT;
+  _cur->total += NOISE_SAMPLE_WEIGHT;
+  _cur->num_samples++;
+  _cur->last_used = millis();
+  if (++_cur->since_decay >= NOISE_DECAY_SAMPLES) decay(*_cur);
+
+  if (millis() - _cur->history_at >= NOISE_HISTORY_MILLIS && isValid()) {
+    _cur->history[_cur->history_next] = getQuantile(*_cur, 50);
+    _cur->history_next = (_cur->history_next + 1) % NOISE_HISTORY_LEN;
+    if (_cur->history_len < NOISE_HISTORY_LEN) _cur->history_len++;
+    _cur->history_at = millis();
+  }
+}
+
+int NoiseFloorEstimator::getQuantile(const NoiseChannel& ch, int pct) {
+  if (ch.total == 0) return NOISE_HIST_MIN_DBM;
+
+  uint32_t target = (ch.total * pct) / 100;
+  uint32_t sum = 0;
+  for (int i = 0; i < NOISE_HIST_BINS; i++) {
+    sum += ch.bins[i];
+    if (sum > target) return NOISE_HIST_MIN_DBM + i;
+  }
+  return NOISE_HIST_MIN_DBM + NOISE_HIST_BINS - 1;
+}
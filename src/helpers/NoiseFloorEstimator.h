@@ -0,0 +1,70 @@
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef NOISE_MAX_CHANNELS
+  #define NOISE_MAX_CHANNELS    9       // scan profiles + home channel
+#endif
+#ifndef NOISE_DECAY_SAMPLES
+  #define NOISE_DECAY_SAMPLES   64      // histogram decays by 1/16 every this many samples
+#endif
+#ifndef NOISE_MIN_SAMPLES
+  #define NOISE_MIN_SAMPLES     32      // before quantiles are considered valid
+#endif
+#ifndef NOISE_HISTORY_LEN
+  #define NOISE_HISTORY_LEN     16
+#endif
+#ifndef NOISE_HISTORY_MILLIS
+  #define NOISE_HISTORY_MILLIS  60000   // one p50 history entry per minute
+#endif
+
+#define NOISE_HIST_MIN_DBM    -140
+#define NOISE_HIST_BINS       80      // 1 dB bins, -140 .. -61 dBm
+#define NOISE_SAMPLE_WEIGHT   16
+
+/**
+ * \brief  noise state for one frequency
+*/
+struct NoiseChannel {
+  float freq;                          // MHz, 0 = unused slot
+  uint16_t bins[NOISE_HIST_BINS];      // exponentially decayed sample weights
+  uint32_t total;                      // sum of 'bins'
+  uint32_t num_samples;
+  uint16_t since_decay;
+  unsigned long last_used;
+  unsigned long history_at;
+  int8_t history[NOISE_HISTORY_LEN];   // p50 (dBm) snapshots, ring buffer
+  uint8_t history_len, history_next;
+};
+
+/**
+ * \brief  streaming noise floor estimator. Keeps a fixed-bin, decaying RSSI histogram per channel, so
+ *         any quantile can be read at any time, with no sample buffers and no bias from the sampling window.
+*/
+class NoiseFloorEstimator {
+  NoiseChannel _channels[NOISE_MAX_CHANNELS];
+  NoiseChannel* _cur;
+
+  static void decay(NoiseChannel& ch);
+
+public:
+  NoiseFloorEstimator();
+
+  /**
+   * \brief  selects the state for 'freq', (re)using the least recently used slot if new.
+  */
+  void setChannel(float freq);
+
+  void addSample(int rssi);
+
+  bool isValid() const { return _cur && _cur->num_samples >= NOISE_MIN_SAMPLES; }
+
+  /**
+   * \returns  the 'pct' percentile noise (dBm) of the current channel
+  */
+  int getQuantile(int pct) const { return _cur ? getQuantile(*_cur, pct) : NOISE_HIST_MIN_DBM; }
+  static int getQuantile(const NoiseChannel& ch, int pct);
+
+  int getNumChannels() const { return NOISE_MAX_CHANNELS; }
+  const NoiseChannel& getChannel(int idx) const { return _channels[idx]; }
+};
@@ -0,0 +1,88 @@
+#include "PCAP.h"
+
+// pcap headers are in the writer's native byte order (the magic tells the reader which),
+// LoRaTap fields are always network (big endian) byte order.
+
+static uint8_t* putLE16(uint8_t* dp, uint16_t v) {
+  *dp++ = v & 0xFF; *dp++ = v >> 8;
+  return dp;
+}
+static uint8_t* putLE32(uint8_t* dp, uint32_t v) {
+  *dp++ = v & 0xFF; *dp++ = (v >> 8) & 0xFF; *dp++ = (v >> 16) & 0xFF; *dp++ = v >> 24;
+  return dp;
+}
+static uint8_t* putBE16(uint8_t* dp, uint16_t v) {
+  *dp++ = v >> 8; *dp++ = v & 0xFF;
+  return dp;
+}
+static uint8_t* putBE32(uint8_t* dp, uint32_t v) {
+  *dp++ = v >> 24; *dp++ = (v >> 16) & 0xFF; *dp++ = (v >> 8) & 0xFF; *dp++ = v & 0xFF;
+  return dp;
+}
+
+// LoRaTap RSSI fields are encoded as (dBm + 139)
+static uint8_t encodeRSSI(float rssi) {
+  return (uint8_t) constrain((int)(rssi + 139.0f), 0, 255);
+}
+
+uint16_t PCAPWriter::encodeGlobalHeader(uint8_t* buf) {
+  uint8_t* dp = buf;
+  dp = putLE32(dp, PCAP_MAGIC);
+  dp = putLE16(dp, PCAP_VERSION_MAJOR);
+  dp = putLE16(dp, PCAP_VERSION_MINOR);
+  dp = putLE32(dp, 0);   // thiszone (UTC)
+  dp = putLE32(dp, 0);   // sigfigs
+  dp = putLE32(dp, PCAP_SNAPLEN);
+  dp = putLE32(dp, PCAP_LINKTYPE_LORATAP);
+  return dp - buf;
+}
+
+uint16_t PCAPWriter::encodeLoRaTapRecord(
+  const LoRaTapInfo& info,
+  const uint8_t* raw, const int len,
+  uint8_t* buf, const int buf_size
+) {
+  int needed = (_header_sent ? 0 : PCAP_GLOBAL_HDR_LEN) + PCAP_RECORD_HDR_LEN + LORATAP_HDR_LEN + len;
+  if (needed > buf_size) {   // (truncating would leave a record that doesn't match its header)
+    n_dropped++;
+    return 0;
+  }
+
+  uint8_t* dp = buf;
+  if (!_header_sent) {
+    dp += encodeGlobalHeader(dp);
+    _header_sent = true;
+  }
+
+  // pcap record header
+  dp = putLE32(dp, info.ts_secs);
+  dp = putLE32(dp, info.ts_usecs);
+  dp = putLE32(dp, LORATAP_HDR_LEN + len);   // incl_len
+  dp = putLE32(dp, LORATAP_HDR_LEN + len);   // orig_len
+
+  // LoRaTap v0 fields
+  *dp++ = LORATAP_VERSION;
+  *dp++ = 0;   // padding
+  dp = putBE16(dp, LORATAP_HDR_LEN);
+  dp = putBE32(dp, (uint32_t)(info.freq * 1000000.0f));   // Hz
+  *dp++ = (uint8_t)(info.bw / 125.0f + 0.5f);   // in 125 kHz steps
+  *dp++ = info.sf;
+  *dp++ = encodeRSSI(info.rssi);          // packet_rssi
+  *dp++ = encodeRSSI(info.rssi);          // max_rssi
+  *dp++ = encodeRSSI(info.noise_floor);   // current_rssi
+  *dp++ = (uint8_t)(int8_t)(info.snr * 4.0f);
+  *dp++ = info.sync_word;
+
+  // LoRaTap v1 fields
+  memset(dp, 0, 8); dp += 8;   // source_gw (EUI-64)
+  dp = putBE32(dp, info.timestamp_us);
+  *dp++ = info.flags;
+  *dp++ = info.cr;
+  dp = putBE16(dp, info.datarate);   // (FSK only)
+  *dp++ = 0;   // if_channel
+  *dp++ = 0;   // rf_chain
+  dp = putBE16(dp, info.tag);
+
+  memcpy(dp, raw, len); dp += len;
+  return dp - buf;
+}
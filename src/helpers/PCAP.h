@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Arduino.h>
+
+// https://wiki.wireshark.org/Development/LibpcapFileFormat
+#define PCAP_MAGIC             0xA1B2C3D4
+#define PCAP_VERSION_MAJOR     2
+#define PCAP_VERSION_MINOR     4
+#define PCAP_SNAPLEN           65535
+#define PCAP_LINKTYPE_LORATAP  270
+
+#define PCAP_GLOBAL_HDR_LEN    24
+#define PCAP_RECORD_HDR_LEN    16
+
+// https://github.com/eriknl/LoRaTap
+#define LORATAP_VERSION        1
+#define LORATAP_HDR_LEN        35
+
+// LoRaTap v1 flag bits
+#define LORATAP_FLAG_MOD_FSK       0x01
+#define LORATAP_FLAG_IQ_INVERTED   0x02
+#define LORATAP_FLAG_IMPLICIT_HDR  0x04
+#define LORATAP_FLAG_CRC_OK        0x08
+#define LORATAP_FLAG_CRC_BAD       0x10
+#define LORATAP_FLAG_NO_CRC        0x20
+
+/**
+ * \brief  radio/capture details of a single received packet, for the LoRaTap pseudo-header.
+*/
+struct LoRaTapInfo {
+  uint32_t ts_secs;       // capture time, UNIX epoch seconds
+  uint32_t ts_usecs;      // capture time, microseconds within 'ts_secs'
+  uint32_t timestamp_us;  // free running microsecond counter (LoRaTap 'timestamp')
+  float freq;             // MHz
+  float bw;               // kHz
+  uint8_t sf;
+  uint8_t cr;             // 5..8  (ie. 4/5 .. 4/8)
+  uint8_t sync_word;
+  uint8_t flags;          // LORATAP_FLAG_*
+  uint16_t datarate;      // FSK only, bits per second / 100
+  float rssi;             // packet RSSI, dBm
+  float snr;              // dB
+  float noise_floor;      // current RSSI, dBm
+  uint16_t tag;
+};
+
+class PCAPWriter {
+  bool _header_sent;
+  uint32_t n_dropped;
+
+  static uint16_t encodeGlobalHeader(uint8_t* buf);
+
+public:
+  PCAPWriter() { _header_sent = false; n_dropped = 0; }
+
+  /**
+   * \brief  re-arms the pcap global header, which is emitted ahead of the next record.
+   *         (so a host can drain the CLI echo after switching mode, then attach the capture)
+  */
+  void reset() { _header_sent = false; }
+
+  /**
+   * \brief  encodes a pcap record (LINKTYPE_LORATAP) for the given raw LoRa packet.
+   * \returns  the length of the encoded data, or 0 if 'buf_size' is too small (the record is then dropped, and counted).
+  */
+  uint16_t encodeLoRaTapRecord(
+    const LoRaTapInfo& info,
+    const uint8_t* raw, const int len,
+    uint8_t* buf, const int buf_size
+  );
+
+  uint32_t getNumDropped() const { return n_dropped; }
+  void resetStats() { n_dropped = 0; }
+};
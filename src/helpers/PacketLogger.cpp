@@ -0,0 +1,164 @@
+#include "PacketLogger.h"
+#include <Utils.h>
+
+void PacketLogger::fileName(char* dest, int idx) const {
+  sprintf(dest, "%s%d", PACKET_LOG_FILE, idx);
+}
+
+File PacketLogger::openForRead(int idx) {
+  char name[24];
+  fileName(name, idx);
+#if defined(RP2040_PLATFORM)
+  return _fs->open(name, "r");
+#else
+  return _fs->open(name);
+#endif
+}
+
+void PacketLogger::startFile(int idx, uint32_t seq) {
+  char name[24];
+  fileName(name, idx);
+#if defined(NRF52_PLATFORM) || defined(STM32_PLATFORM)
+  _fs->remove(name);
+  File file = _fs->open(name, FILE_O_WRITE);
+#elif defined(RP2040_PLATFORM)
+  File file = _fs->open(name, "w");
+#else
+  File file = _fs->open(name, "w", true);
+#endif
+  if (file) {
+    file.write((uint8_t *) &seq, sizeof(seq));
+    file.close();
+  }
+  _cur_file = idx;
+  _cur_seq = seq;
+  _cur_size = sizeof(seq);
+}
+
+void PacketLogger::begin(FILESYSTEM* fs) {
+  _fs = fs;
+  _buf_len = 0;
+
+  // find newest ring file, resume appending to it
+  bool found = false;
+  for (int i = 0; i < PACKET_LOG_NUM_FILES; i++) {
+    File file = openForRead(i);
+    if (!file) continue;
+
+    uint32_t seq;
+    if (file.read((uint8_t *) &seq, sizeof(seq)) == sizeof(seq) && (!found || (int32_t)(seq - _cur_seq) > 0)) {
+      found = true;
+      _cur_file = i;
+      _cur_seq = seq;
+      _cur_size = file.size();
+    }
+    file.close();
+  }
+  if (!found) {
+    startFile(0, 1);
+  }
+}
+
+void PacketLogger::setEnabled(bool enable) {
+  if (_enabled && !enable) flush();
+  _enabled = enable;
+}
+
+void PacketLogger::logRx(uint64_t rx_time, uint32_t rx_micros, float rssi, float snr, uint8_t flags, const uint8_t raw[], int len) {
+  if (!_enabled || _fs == NULL) return;
+
+  if (_buf_len + PACKET_LOG_REC_HDR_LEN + len > sizeof(_buf)) {
+    flush();
+  }
+  if (_buf_len == 0) _first_pending = millis();
+
+  uint8_t* dp = &_buf[_buf_len];
+  *dp++ = PACKET_LOG_REC_MAGIC;
+  *dp++ = len;
+  *dp++ = flags;
+  *dp++ = (int8_t) constrain((int)rssi, -128, 127);
+  *dp++ = (int8_t) constrain((int)(snr * 4.0f), -128, 127);
+  memcpy(dp, &rx_time, 8); dp += 8;
+  memcpy(dp, &rx_micros, 4); dp += 4;
+  memcpy(dp, raw, len); dp += len;
+  _buf_len = dp - _buf;
+}
+
+void PacketLogger::loop() {
+  if (_buf_len > 0 && millis() - _first_pending >= PACKET_LOG_FLUSH_MILLIS) {
+    flush();
+  }
+}
+
+void PacketLogger::flush() {
+  if (_buf_len == 0 || _fs == NULL) return;
+
+  if (_cur_size + _buf_len > PACKET_LOG_FILE_SIZE) {   // rotate to next (oldest) file in ring
+    startFile((_cur_file + 1) % PACKET_LOG_NUM_FILES, _cur_seq + 1);
+  }
+
+  char name[24];
+  fileName(name, _cur_file);
+#if defined(NRF52_PLATFORM) || defined(STM32_PLATFORM)
+  File file = _fs->open(name, FILE_O_WRITE);   // NOTE: opens at end of file
+#else
+  File file = _fs->open(name, "a");
+#endif
+  if (file) {
+    file.write(_buf, _buf_len);
+    file.close();
+    _cur_size += _buf_len;
+  }
+  _buf_len = 0;
+}
+
+void PacketLogger::erase() {
+  _buf_len = 0;
+  char name[24];
+  for (int i = 0; i < PACKET_LOG_NUM_FILES; i++) {
+    fileName(name, i);
+    _fs->remove(name);
+  }
+  _fs->remove(PACKET_LOG_FILE);   // legacy, single file log
+  startFile(0, _cur_seq + 1);
+}
+
+void PacketLogger::dumpFile(Stream& out, int idx, bool binary) {
+  File file = openForRead(idx);
+  if (!file) return;
+
+  uint32_t seq;
+  if (file.read((uint8_t *) &seq, sizeof(seq)) == sizeof(seq)) {
+    uint8_t hdr[PACKET_LOG_REC_HDR_LEN];
+    uint8_t raw[256];
+    while (file.read(hdr, sizeof(hdr)) == sizeof(hdr)) {
+      if (hdr[0] != PACKET_LOG_REC_MAGIC) break;   // corrupt / truncated record
+      int len = hdr[1];
+      if (file.read(raw, len) != len) break;
+
+      if (binary) {
+        out.write(hdr, sizeof(hdr));
+        out.write(raw, len);
+      } else {
+        uint64_t rx_time;
+        uint32_t rx_micros;
+        memcpy(&rx_time, &hdr[5], 8);
+        memcpy(&rx_micros, &hdr[13], 4);
+        out.printf("%lu,%s,%.2f,%.2f,", (unsigned long) (rx_time / 1000), (hdr[2] & PACKET_LOG_FLAG_CRC_BAD) ? "RXBAD" : "RXLOG",
+                   (float)(int8_t)hdr[3], ((float)(int8_t)hdr[4]) / 4.0f);
+        mesh::Utils::printHex(out, raw, len);
+        out.printf(",%lu%03u,%lu\n", (unsigned long) (rx_time / 1000), (uint32_t) (rx_time % 1000), (unsigned long) rx_micros);
+      }
+    }
+  }
+  file.close();
+}
+
+void PacketLogger::dump(Stream& out, bool binary) {
+  if (_fs == NULL) return;
+  flush();
+
+  for (int i = 1; i <= PACKET_LOG_NUM_FILES; i++) {   // oldest first
+    dumpFile(out, (_cur_file + i) % PACKET_LOG_NUM_FILES, binary);
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Arduino.h>
+
+#if defined(ESP32) || defined(RP2040_PLATFORM)
+  #include <FS.h>
+  #define FILESYSTEM  fs::FS
+#elif defined(NRF52_PLATFORM) || defined(STM32_PLATFORM)
+  #include <Adafruit_LittleFS.h>
+  #define FILESYSTEM  Adafruit_LittleFS
+
+  using namespace Adafruit_LittleFS_Namespace;
+#endif
+
+#define PACKET_LOG_FILE  "/packet_log"   // ring files are "/packet_log0" .. "/packet_log<N-1>"
+
+#ifndef PACKET_LOG_NUM_FILES
+  #define PACKET_LOG_NUM_FILES     4
+#endif
+#ifndef PACKET_LOG_FILE_SIZE
+  #define PACKET_LOG_FILE_SIZE     (16*1024)
+#endif
+#ifndef PACKET_LOG_BUF_SIZE
+  #define PACKET_LOG_BUF_SIZE      512      // RAM batch, flushed to flash in one write
+#endif
+#ifndef PACKET_LOG_FLUSH_MILLIS
+  #define PACKET_LOG_FLUSH_MILLIS  30000    // max time a record sits in RAM
+#endif
+
+#define PACKET_LOG_REC_MAGIC     0xA6
+#define PACKET_LOG_REC_HDR_LEN   17
+
+#define PACKET_LOG_FLAG_CRC_BAD  0x01
+
+/*
+ *  Record layout (little endian):
+ *    magic(1) | len(1) | flags(1) | rssi(1, int8 dBm) | snr(1, int8 dB*4) | rx_time(8, epoch millis) | rx_micros(4) | raw[len]
+ *
+ *  'rx_time' is the end of packet, back-dated from the radio interrupt. 'rx_micros' is the raw micros() latched in the ISR.
+ *
+ *  Each ring file starts with a 4 byte sequence number, the file with the highest sequence is the newest.
+ */
+
+class PacketLogger {
+  FILESYSTEM* _fs;
+  uint8_t _buf[PACKET_LOG_BUF_SIZE];
+  int _buf_len;
+  uint8_t _cur_file;
+  uint32_t _cur_seq;
+  uint32_t _cur_size;
+  unsigned long _first_pending;
+  bool _enabled;
+
+  void fileName(char* dest, int idx) const;
+  File openForRead(int idx);
+  void startFile(int idx, uint32_t seq);
+  void dumpFile(Stream& out, int idx, bool binary);
+
+public:
+  PacketLogger() { _fs = NULL; _buf_len = 0; _cur_file = 0; _cur_seq = 0; _cur_size = 0; _enabled = false; }
+
+  void begin(FILESYSTEM* fs);
+  void setEnabled(bool enable);
+  bool isEnabled() const { return _enabled; }
+
+  /**
+   * \brief  appends a received packet to the RAM batch. (only hits flash when the batch is full)
+  */
+  void logRx(uint64_t rx_time, uint32_t rx_micros, float rssi, float snr, uint8_t flags, const uint8_t raw[], int len);
+
+  /**
+   * \brief  flushes the RAM batch if it has been pending longer than PACKET_LOG_FLUSH_MILLIS
+  */
+  void loop();
+
+  void flush();
+  void erase();
+
+  /**
+   * \brief  dumps all records, oldest first. Either as RXLOG style hex lines, or the raw binary records.
+  */
+  void dump(Stream& out, bool binary);
+};
@@ -0,0 +1,25 @@
+#include "RadioRecovery.h"
+
+uint8_t RadioRecovery::onFault(uint16_t err_event, unsigned long now) {
+  n_faults++;
+  _last_fault = now;
+  _last_err = err_event;
+
+  if (!_enabled) return RECOVERY_ACTION_NONE;
+  if (_backoff > 0 && now - _last_action < _backoff) return RECOVERY_ACTION_NONE;   // give last action time to work
+
+  uint8_t action = _level;
+  if (action == RECOVERY_ACTION_REARM) n_rearms++;
+  else if (action == RECOVERY_ACTION_REINIT) n_reinits++;
+
+  _last_action = now;
+  _backoff = ((uint32_t) RECOVERY_BACKOFF_MILLIS) << (action - 1);
+  if (_level < RECOVERY_ACTION_REBOOT) _level++;
+  return action;
+}
+
+void RadioRecovery::loop(unsigned long now) {
+  if (_level != RECOVERY_ACTION_REARM && now - _last_fault >= RECOVERY_STABLE_MILLIS) {
+    reset();   // radio has been fine for a while, start over at the gentlest action
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef RECOVERY_BACKOFF_MILLIS
+  #define RECOVERY_BACKOFF_MILLIS   10000    // after an action, faults are ignored this long (doubles each level)
+#endif
+#ifndef RECOVERY_STABLE_MILLIS
+  #define RECOVERY_STABLE_MILLIS    300000   // fault-free time before escalation starts over at re-arm
+#endif
+
+#define RECOVERY_ACTION_NONE     0
+#define RECOVERY_ACTION_REARM    1    // standby, then startReceive() again
+#define RECOVERY_ACTION_REINIT   2    // radio_init() + restore radio params
+#define RECOVERY_ACTION_REBOOT   3
+
+/**
+ * \brief  decides how hard to kick a radio that has faulted (stuck outside RX, CAD busy timeout).
+ *         Each fault that arrives after the backoff of the previous action escalates one level,
+ *         and a long enough fault-free period starts over at re-arm.
+*/
+class RadioRecovery {
+  uint8_t _level;       // action for the next fault
+  bool _enabled;
+  unsigned long _last_action, _last_fault;
+  uint32_t _backoff;
+  uint16_t _last_err;
+  uint32_t n_faults, n_rearms, n_reinits, n_reinit_fails;
+
+public:
+  RadioRecovery() { _enabled = true; _last_fault = 0; _last_err = 0; reset(); resetStats(); }
+
+  void setEnabled(bool enable) { _enabled = enable; }
+  bool isEnabled() const { return _enabled; }
+
+  /**
+   * \brief  records a fault.
+   * \returns  the RECOVERY_ACTION_* to take now. (NONE while disabled, or the last action is still in backoff)
+  */
+  uint8_t onFault(uint16_t err_event, unsigned long now);
+
+  void onReinitResult(bool success) { if (!success) n_reinit_fails++; }
+
+  /**
+   * \brief  call regularly, to de-escalate once the radio has been healthy for RECOVERY_STABLE_MILLIS
+  */
+  void loop(unsigned long now);
+
+  void reset() { _level = RECOVERY_ACTION_REARM; _last_action = 0; _backoff = 0; }
+  void resetStats() { n_faults = n_rearms = n_reinits = n_reinit_fails = 0; }
+
+  uint8_t getLevel() const { return _level; }
+  uint16_t getLastError() const { return _last_err; }
+  unsigned long getLastFaultTime() const { return _last_fault; }
+  uint32_t getNumFaults() const { return n_faults; }
+  uint32_t getNumRearms() const { return n_rearms; }
+  uint32_t getNumReinits() const { return n_reinits; }
+  uint32_t getNumReinitFails() const { return n_reinit_fails; }
+};
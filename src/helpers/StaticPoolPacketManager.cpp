@@ -17,28 +17,33 @@ int PacketQueue::countBefore(uint32_t now) const {
   return n;
 }
 
-mesh::Packet* PacketQueue::get(uint32_t now) {
+int PacketQueue::countClass(uint8_t tx_class) const {
+  int n = 0;
+  for (int j = 0; j < _num; j++) {
+    if (_table[j]->tx_class == tx_class) n++;
+  }
+  return n;
+}
+
+int PacketQueue::find(uint32_t now, int max_len, int tx_class) const {
   uint8_t min_pri = 0xFF;
   int best_idx = -1;
   for (int j = 0; j < _num; j++) {
     if (_schedule_table[j] > now) continue;   // scheduled for future... ignore for now
+    if (_table[j]->payload_len > max_len) continue;   // too long for the time left
+    if (tx_class >= 0 && _table[j]->tx_class != tx_class) continue;
     if (_pri_table[j] < min_pri) {  // select most important priority amongst non-future entries
       min_pri = _pri_table[j];
       best_idx = j;
     }
   }
-  if (best_idx < 0) return NULL;   // empty, or all items are still in the future
+  return best_idx;   // -1 if empty, or all items are still in the future
+}
 
-  mesh::Packet* top = _table[best_idx];
-  int i = best_idx;
-  _num--;
-  while (i < _num) {
-    _table[i] = _table[i+1];
-    _pri_table[i] = _pri_table[i+1];
-    _schedule_table[i] = _schedule_table[i+1];
-    i++;
-  }
-  return top;
+mesh::Packet* PacketQueue::get(uint32_t now, int max_len) {
+  int i = find(now, max_len);
+  if (i < 0) return NULL;
+  return removeByIdx(i);
 }
 
 mesh::Packet* PacketQueue::removeByIdx(int i) {
@@ -66,11 +71,34 @@ void PacketQueue::add(mesh::Packet* packet, uint8_t priority, uint32_t scheduled
   _num++;
 }
 
+void PacketQueue::insert(int i, mesh::Packet* packet, uint8_t priority, uint32_t scheduled_for) {
+  if (_num == _size) return;
+  if (i > _num) i = _num;
+  for (int j = _num; j > i; j--) {
+    _table[j] = _table[j-1];
+    _pri_table[j] = _pri_table[j-1];
+    _schedule_table[j] = _schedule_table[j-1];
+  }
+  _table[i] = packet;
+  _pri_table[i] = priority;
+  _schedule_table[i] = scheduled_for;
+  _num++;
+}
+
 StaticPoolPacketManager::StaticPoolPacketManager(int pool_size): unused(pool_size), send_queue(pool_size), rx_queue(pool_size) {
   // load up our unusued Packet pool
   for (int i = 0; i < pool_size; i++) {
     unused.add(new mesh::Packet(), 0, 0);
   }
+  for (int c = 0; c < MAX_TX_CLASSES; c++) {
+    _weights[c] = 1;
+    _deficit[c] = 0;
+  }
+  _drr_cur = 0;
+  _last_idx = 0;
+  _last_pri = 0;
+  _last_sched = 0;
+  resetClassStats();
 }
 
 mesh::Packet* StaticPoolPacketManager::allocNew() {
@@ -86,8 +114,77 @@ void StaticPoolPacketManager::queueOutbound(mesh::Packet* packet, uint8_t priori
 }
 
 mesh::Packet* StaticPoolPacketManager::getNextOutbound(uint32_t now) {
-  //send_queue.sort();   // sort by scheduled_for/priority first
-  return send_queue.get(now);
+  return getNextOutbound(now, 0x7FFF);
+}
+mesh::Packet* StaticPoolPacketManager::getNextOutbound(uint32_t now, int max_len) {
+  int due[MAX_TX_CLASSES];
+  bool any_due = false, any_credit = false;
+  for (int c = 0; c < MAX_TX_CLASSES; c++) {
+    due[c] = send_queue.find(now, max_len, c);
+    if (due[c] < 0) {
+      _deficit[c] = 0;   // an idle class doesn't bank credit
+    } else {
+      any_due = true;
+      if (_deficit[c] > 0) any_credit = true;
+    }
+  }
+  if (!any_due) return NULL;
+
+  if (!any_credit) {
+    // skip ahead the number of rounds it takes for the first waiting class to be back in credit
+    uint32_t rounds = 0xFFFFFFFF;
+    for (int c = 0; c < MAX_TX_CLASSES; c++) {
+      if (due[c] < 0) continue;
+      uint32_t quantum = _weights[c] * DRR_QUANTUM_MILLIS;
+      uint32_t r = (1 - _deficit[c] + quantum - 1) / quantum;
+      if (r < rounds) rounds = r;
+    }
+    for (int c = 0; c < MAX_TX_CLASSES; c++) {
+      if (due[c] >= 0) _deficit[c] += rounds * _weights[c] * DRR_QUANTUM_MILLIS;
+    }
+  }
+
+  // keep serving the current class while it's in credit, then move round to the next
+  for (int k = 0; k < MAX_TX_CLASSES; k++) {
+    int c = (_drr_cur + k) % MAX_TX_CLASSES;
+    if (due[c] >= 0 && _deficit[c] > 0) {
+      _drr_cur = c;
+      _last_idx = due[c];
+      _last_pri = send_queue.priorityAt(due[c]);
+      _last_sched = send_queue.scheduledAt(due[c]);
+      return send_queue.removeByIdx(due[c]);
+    }
+  }
+  return NULL;  // not reached
+}
+
+void StaticPoolPacketManager::returnOutbound(mesh::Packet* packet) {
+  send_queue.insert(_last_idx, packet, _last_pri, _last_sched);   // same place, so fragments stay in order
+}
+
+void StaticPoolPacketManager::onPacketSent(const mesh::Packet* packet, uint32_t airtime_millis) {
+  uint8_t c = packet->tx_class < MAX_TX_CLASSES ? packet->tx_class : 0;
+  _deficit[c] -= airtime_millis;
+  _n_sent[c]++;
+  _airtime[c] += airtime_millis;
+}
+
+void StaticPoolPacketManager::setClassWeight(uint8_t tx_class, uint8_t weight) {
+  if (tx_class < MAX_TX_CLASSES) _weights[tx_class] = weight > 0 ? weight : 1;
+}
+
+bool StaticPoolPacketManager::getClassStats(uint8_t tx_class, mesh::TxClassStats& stats) const {
+  if (tx_class >= MAX_TX_CLASSES) return false;
+  stats.weight = _weights[tx_class];
+  stats.queued = send_queue.countClass(tx_class);
+  stats.n_sent = _n_sent[tx_class];
+  stats.airtime = _airtime[tx_class];
+  return true;
+}
+
+void StaticPoolPacketManager::resetClassStats() {
+  memset(_n_sent, 0, sizeof(_n_sent));
+  memset(_airtime, 0, sizeof(_airtime));
 }
 
 int  StaticPoolPacketManager::getOutboundCount(uint32_t now) const {
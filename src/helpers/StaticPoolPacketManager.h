@@ -2,6 +2,10 @@
 
 #include <Dispatcher.h>
 
+#ifndef DRR_QUANTUM_MILLIS
+  #define DRR_QUANTUM_MILLIS   50    // airtime credit per unit of class weight, per round
+#endif
+
 class PacketQueue {
   mesh::Packet** _table;
   uint8_t* _pri_table;
@@ -10,16 +14,33 @@ class PacketQueue {
 
 public:
   PacketQueue(int max_entries);
-  mesh::Packet* get(uint32_t now);
+  int find(uint32_t now, int max_len=0x7FFF, int tx_class=-1) const;
+  mesh::Packet* get(uint32_t now, int max_len=0x7FFF);
   void add(mesh::Packet* packet, uint8_t priority, uint32_t scheduled_for);
+  void insert(int i, mesh::Packet* packet, uint8_t priority, uint32_t scheduled_for);
   int count() const { return _num; }
   int countBefore(uint32_t now) const;
+  int countClass(uint8_t tx_class) const;
   mesh::Packet* itemAt(int i) const { return _table[i]; }
+  uint8_t priorityAt(int i) const { return _pri_table[i]; }
+  uint32_t scheduledAt(int i) const { return _schedule_table[i]; }
   mesh::Packet* removeByIdx(int i);
 };
 
+/**
+ * \brief  outbound packets are shared between traffic classes with deficit round robin, where
+ *         the deficit is airtime (not packet count), so a class sending at SF12 doesn't out-weigh one
+ *         sending short frames. Within a class, the lowest priority value goes first, as before.
+*/
 class StaticPoolPacketManager : public mesh::PacketManager {
   PacketQueue unused, send_queue, rx_queue;
+  uint8_t _weights[MAX_TX_CLASSES];
+  int32_t _deficit[MAX_TX_CLASSES];   // airtime millis this class may still use this round
+  uint8_t _drr_cur;
+  int _last_idx;     // where the last getNextOutbound() came from, for returnOutbound()
+  uint8_t _last_pri;
+  uint32_t _last_sched;
+  uint32_t _n_sent[MAX_TX_CLASSES], _airtime[MAX_TX_CLASSES];
 
 public:
   StaticPoolPacketManager(int pool_size);
@@ -28,10 +49,19 @@ public:
   void free(mesh::Packet* packet) override;
   void queueOutbound(mesh::Packet* packet, uint8_t priority, uint32_t scheduled_for) override;
   mesh::Packet* getNextOutbound(uint32_t now) override;
+  mesh::Packet* getNextOutbound(uint32_t now, int max_len) override;
+  void returnOutbound(mesh::Packet* packet) override;
   int getOutboundCount(uint32_t now) const override;
   int getFreeCount() const override;
+  int getOutboundTotal() const override { return send_queue.count(); }
   mesh::Packet* getOutboundByIdx(int i) override;
+  uint8_t getOutboundPriority(int i) const override { return send_queue.priorityAt(i); }
+  uint32_t getOutboundScheduledFor(int i) const override { return send_queue.scheduledAt(i); }
   mesh::Packet* removeOutboundByIdx(int i) override;
   void queueInbound(mesh::Packet* packet, uint32_t scheduled_for) override;
   mesh::Packet* getNextInbound(uint32_t now) override;
+  void onPacketSent(const mesh::Packet* packet, uint32_t airtime_millis) override;
+  void setClassWeight(uint8_t tx_class, uint8_t weight) override;
+  bool getClassStats(uint8_t tx_class, mesh::TxClassStats& stats) const override;
+  void resetClassStats() override;
 };
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include "TDMASchedule.h"
+
+bool TDMASchedule::isValid(uint32_t frame_ms, uint8_t num_slots, uint32_t slot_mask, uint16_t guard_ms) {
+  if (num_slots < 1 || num_slots > TDMA_MAX_SLOTS || frame_ms < num_slots) return false;
+  if (slot_mask == 0 || (num_slots < 32 && (slot_mask >> num_slots) != 0)) return false;
+  return guard_ms * 2 < frame_ms / num_slots;
+}
+
+void TDMASchedule::configure(bool enable, uint32_t frame_ms, uint8_t num_slots, uint32_t slot_mask, uint16_t guard_ms) {
+  _enabled = enable && isValid(frame_ms, num_slots, slot_mask, guard_ms);
+  _frame_ms = frame_ms;
+  _num_slots = num_slots < 1 ? 1 : num_slots;
+  _slot_mask = slot_mask;
+  _guard_ms = guard_ms;
+}
+
+uint32_t TDMASchedule::getTxRemaining(uint64_t now_ms) const {
+  uint32_t slot_ms = getSlotMillis();
+  uint32_t pos = now_ms % _frame_ms;
+  uint32_t slot = pos / slot_ms;
+  if (slot >= _num_slots || (_slot_mask & (1UL << slot)) == 0) return 0;   // (or in the leftover at end of frame)
+
+  uint32_t start = slot * slot_ms;
+  if (pos < start + _guard_ms && (slot == 0 || (_slot_mask & (1UL << (slot - 1))) == 0)) return 0;   // leading guard
+
+  uint32_t end = start + slot_ms;
+  while (slot + 1 < _num_slots && (_slot_mask & (1UL << (slot + 1)))) {   // run on into our next slot
+    slot++;
+    end += slot_ms;
+  }
+  end -= _guard_ms;
+  return pos < end ? end - pos : 0;
+}
+
+uint32_t TDMASchedule::getMaxTxMillis() const {
+  int run = 0, longest = 0;
+  for (int slot = 0; slot < _num_slots; slot++) {
+    run = (_slot_mask & (1UL << slot)) ? run + 1 : 0;
+    if (run > longest) longest = run;
+  }
+  uint32_t ms = longest * getSlotMillis();
+  return ms > 2 * _guard_ms ? ms - 2 * _guard_ms : 0;
+}
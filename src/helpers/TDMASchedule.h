@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define TDMA_MAX_SLOTS   32
+
+/**
+ * \brief  a fixed TDMA frame, split into equal slots, aligned to RTC time (frames start at multiples of the
+ *         frame length since the epoch). This node transmits only in its own slots, and not within the guard
+ *         time at either end of them, to allow for clock error between nodes.
+*/
+class TDMASchedule {
+  bool _enabled;
+  uint32_t _frame_ms;
+  uint8_t _num_slots;
+  uint32_t _slot_mask;   // bit N = slot N is ours
+  uint16_t _guard_ms;
+
+public:
+  TDMASchedule() { _enabled = false; _frame_ms = 0; _num_slots = 1; _slot_mask = 0; _guard_ms = 0; }
+
+  static bool isValid(uint32_t frame_ms, uint8_t num_slots, uint32_t slot_mask, uint16_t guard_ms);
+
+  void configure(bool enable, uint32_t frame_ms, uint8_t num_slots, uint32_t slot_mask, uint16_t guard_ms);
+  bool isEnabled() const { return _enabled; }
+  uint32_t getSlotMillis() const { return _frame_ms / _num_slots; }
+
+  /**
+   * \param  now_ms  RTC time, epoch millis
+   * \returns  millis left to transmit in, from now until the guard time before the end of this node's
+   *           current slot (run of consecutive slots), or 0 if not in one of its slots
+  */
+  uint32_t getTxRemaining(uint64_t now_ms) const;
+
+  /**
+   * \returns  the most getTxRemaining() can be, ie. this node's longest run of consecutive slots, less the guard times
+  */
+  uint32_t getMaxTxMillis() const;
+};
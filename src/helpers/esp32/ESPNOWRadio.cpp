@@ -87,7 +87,7 @@ bool ESPNOWRadio::startSendRaw(const uint8_t* bytes, int len) {
 bool ESPNOWRadio::isSendComplete() {
   return is_send_complete;
 }
-void ESPNOWRadio::onSendFinished() {
+void ESPNOWRadio::onSendFinished(bool rearm) {
   is_send_complete = true;
 }
 
@@ -14,7 +14,7 @@ public:
   uint32_t getEstAirtimeFor(int len_bytes) override;
   bool startSendRaw(const uint8_t* bytes, int len) override;
   bool isSendComplete() override;
-  void onSendFinished() override;
+  void onSendFinished(bool rearm) override;
   bool isInRecvMode() const override;
 
   uint32_t getPacketsRecv() const { return n_recv; }
@@ -9,18 +9,50 @@ public:
   bool isReceivingPacket() override { 
     return ((CustomLR1110 *)_radio)->isReceiving();
   }
+  uint8_t getRxEventFlags() override {
+    uint16_t irq = ((CustomLR1110 *)_radio)->getIrqStatus();
+    return ((irq & LR1110_IRQ_HAS_PREAMBLE) ? RX_EVENT_PREAMBLE : 0) | ((irq & LR1110_IRQ_HEADER_VALID) ? RX_EVENT_HEADER : 0);
+  }
   float getCurrentRSSI() override {
     float rssi = -110;
     ((CustomLR1110 *)_radio)->getRssiInst(&rssi);
     return rssi;
   }
 
-  void onSendFinished() override {
-    RadioLibWrapper::onSendFinished();
-    _radio->setPreambleLength(16); // overcomes weird issues with small and big pkts
+  int16_t performCAD() override {
+    uint8_t sym_num, det_peak, det_min;
+    getCADParams(((CustomLR1110 *)_radio)->spreadingFactor, sym_num, det_peak, det_min);
+
+    ChannelScanConfig_t config;
+    config.cad.symNum = sym_num;
+    config.cad.detPeak = det_peak;
+    config.cad.detMin = det_min;
+    config.cad.exitMode = RADIOLIB_LR11X0_CAD_EXIT_MODE_STBY_RC;
+    config.cad.timeout = 0;
+    config.cad.irqFlags = RADIOLIB_IRQ_CAD_DEFAULT_FLAGS;
+    config.cad.irqMask = RADIOLIB_IRQ_CAD_DEFAULT_MASK;
+    return ((CustomLR1110 *)_radio)->scanChannel(config);
+  }
+
+  void afterTransmit() override {
+    // overcomes weird issues with small and big pkts. NOTE: restores the active preamble, not a fixed 16
+    _radio->setPreambleLength(isFSK() ? FSK_PREAMBLE_BITS : getLoRaPreamble(_params));
   }
 
-  float getLastRSSI() const override { return ((CustomLR1110 *)_radio)->getRSSI(); }
-  float getLastSNR() const override { return ((CustomLR1110 *)_radio)->getSNR(); }
+  int16_t switchModem(uint8_t modem) override {
+    return ((CustomLR1110 *)_radio)->config(modem == RADIO_MODEM_FSK ? RADIOLIB_LR11X0_PACKET_TYPE_GFSK : RADIOLIB_LR11X0_PACKET_TYPE_LORA);
+  }
+
+  void readRxMeta(mesh::RxMetadata& meta) override {
+    if (isFSK()) {
+      readFSKRxMeta(meta);
+      return;
+    }
+    // one GetPacketStatus command for all three values
+    if (((CustomLR1110 *)_radio)->getPacketStatusLoRa(&meta.rssi, &meta.snr, &meta.signal_rssi) != RADIOLIB_ERR_NONE) {
+      meta.rssi = meta.signal_rssi = meta.snr = 0;
+    }
+    meta.freq_error = 0;   // not available on LR11x0
+  }
   int16_t setRxBoostedGainMode(bool en) { return ((CustomLR1110 *)_radio)->setRxBoostedGainMode(en); };
 };
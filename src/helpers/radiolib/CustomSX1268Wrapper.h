@@ -9,14 +9,21 @@ public:
   bool isReceivingPacket() override { 
     return ((CustomSX1268 *)_radio)->isReceiving();
   }
+  uint8_t getRxEventFlags() override {
+    uint16_t irq = ((CustomSX1268 *)_radio)->getIrqFlags();
+    return ((irq & SX126X_IRQ_PREAMBLE_DETECTED) ? RX_EVENT_PREAMBLE : 0) | ((irq & SX126X_IRQ_HEADER_VALID) ? RX_EVENT_HEADER : 0);
+  }
   float getCurrentRSSI() override {
     return ((CustomSX1268 *)_radio)->getRSSI(false);
   }
-  float getLastRSSI() const override { return ((CustomSX1268 *)_radio)->getRSSI(); }
-  float getLastSNR() const override { return ((CustomSX1268 *)_radio)->getSNR(); }
+  void readRxMeta(mesh::RxMetadata& meta) override {
+    if (isFSK()) readFSKRxMeta(meta); else readSX126xRxMeta((CustomSX1268 *)_radio, meta);
+  }
+  int16_t switchModem(uint8_t modem) override { return switchSX126xModem((CustomSX1268 *)_radio, modem); }
+  int16_t performCAD() override { return scanSX126xChannel((CustomSX1268 *)_radio); }
 
   float packetScore(float snr, int packet_len) override {
-    int sf = ((CustomSX1268 *)_radio)->spreadingFactor;
+    int sf = isFSK() ? 0 : ((CustomSX1268 *)_radio)->spreadingFactor;
     return packetScoreInt(snr, sf, packet_len);
   }
 };
@@ -9,14 +9,34 @@ public:
   bool isReceivingPacket() override { 
     return ((CustomSX1276 *)_radio)->isReceiving();
   }
+  uint8_t getRxEventFlags() override {   // NOTE: modem status is live, not latched
+    int16_t status = ((CustomSX1276 *)_radio)->getModemStatus();
+    return ((status & (RH_RF95_MODEM_STATUS_SIGNAL_DETECTED | RH_RF95_MODEM_STATUS_SIGNAL_SYNCHRONIZED)) ? RX_EVENT_PREAMBLE : 0)
+         | ((status & RH_RF95_MODEM_STATUS_HEADER_INFO_VALID) ? RX_EVENT_HEADER : 0);
+  }
   float getCurrentRSSI() override {
     return ((CustomSX1276 *)_radio)->getRSSI(false);
   }
-  float getLastRSSI() const override { return ((CustomSX1276 *)_radio)->getRSSI(); }
-  float getLastSNR() const override { return ((CustomSX1276 *)_radio)->getSNR(); }
+  void readRxMeta(mesh::RxMetadata& meta) override {
+    if (isFSK()) {
+      readFSKRxMeta(meta);
+      return;
+    }
+    meta.rssi = meta.signal_rssi = ((CustomSX1276 *)_radio)->getRSSI();
+    meta.snr = ((CustomSX1276 *)_radio)->getSNR();
+    meta.freq_error = ((CustomSX1276 *)_radio)->getFrequencyError();
+  }
+  int16_t switchModem(uint8_t modem) override {
+    CustomSX1276* radio = (CustomSX1276 *)_radio;
+    if (modem == RADIO_MODEM_FSK) {
+      int16_t err = radio->setActiveModem(RADIOLIB_SX127X_FSK_OOK);
+      return err == RADIOLIB_ERR_NONE ? radio->configFSK() : err;
+    }
+    return radio->setActiveModem(RADIOLIB_SX127X_LORA);
+  }
 
   float packetScore(float snr, int packet_len) override {
-    int sf = ((CustomSX1276 *)_radio)->spreadingFactor;
+    int sf = isFSK() ? 0 : ((CustomSX1276 *)_radio)->spreadingFactor;
     return packetScoreInt(snr, sf, packet_len);
   }
 };
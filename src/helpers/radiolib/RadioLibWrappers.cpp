@@ -8,10 +8,23 @@
 #define STATE_TX_DONE    4
 #define STATE_INT_READY 16
 
-#define NUM_NOISE_FLOOR_SAMPLES  64
-#define SAMPLING_THRESHOLD  14
+#ifndef NOISE_SAMPLE_MILLIS
+  #define NOISE_SAMPLE_MILLIS  20     // RSSI sample interval, while idle in RX
+#endif
+
+#ifndef SURVEY_SETTLE_MICROS
+  #define SURVEY_SETTLE_MICROS   500    // after retune, before first RSSI sample
+#endif
+#ifndef SURVEY_SAMPLE_MICROS
+  #define SURVEY_SAMPLE_MICROS   100    // between RSSI samples
+#endif
+
+#ifndef LBT_RSSI_FALLBACK_MARGIN
+  #define LBT_RSSI_FALLBACK_MARGIN  3   // dB above p90 noise, when CAD fails and int.thresh is not set
+#endif
 
 static volatile uint8_t state = STATE_IDLE;
+static volatile uint32_t irq_micros = 0;   // micros() latched at last DIO interrupt
 
 // this function is called when a complete packet
 // is transmitted by the module
@@ -21,6 +34,7 @@ static
 #endif
 void setFlag(void) {
   // we sent a packet, set the flag
+  irq_micros = micros();
   state |= STATE_INT_READY;
 }
 
@@ -34,10 +48,7 @@ void RadioLibWrapper::begin() {
 
   _noise_floor = 0;
   _threshold = 0;
-
-  // start average out some samples
-  _num_floor_samples = 0;
-  _floor_sample_sum = 0;
+  _last_noise_sample = 0;
 }
 
 void RadioLibWrapper::idle() {
@@ -45,12 +56,20 @@ void RadioLibWrapper::idle() {
   state = STATE_IDLE;   // need another startReceive()
 }
 
+void RadioLibWrapper::rearm() {
+  idle();
+  startRecv();
+}
+
+void RadioLibWrapper::onRadioReset() {
+  _radio->setPacketReceivedAction(setFlag);
+  state = STATE_IDLE;
+  _cad_err = false;
+  _params_valid = false;   // chip is back to its init() defaults
+}
+
 void RadioLibWrapper::triggerNoiseFloorCalibrate(int threshold) {
-  _threshold = threshold;
-  if (_num_floor_samples >= NUM_NOISE_FLOOR_SAMPLES) {  // ignore trigger if currently sampling
-    _num_floor_samples = 0;
-    _floor_sample_sum = 0;
-  }
+  _threshold = threshold;   // NOTE: noise is now sampled continuously, in loop()
 }
 
 void RadioLibWrapper::resetAGC() {
@@ -63,29 +82,37 @@ void RadioLibWrapper::resetAGC() {
 }
 
 void RadioLibWrapper::loop() {
-  if (state == STATE_RX && _num_floor_samples < NUM_NOISE_FLOOR_SAMPLES) {
-    if (!isReceivingPacket()) {
-      int rssi = getCurrentRSSI();
-      if (rssi < _noise_floor + SAMPLING_THRESHOLD) {  // only consider samples below current floor + sampling THRESHOLD
-        _num_floor_samples++;
-        _floor_sample_sum += rssi;
+  if (state == STATE_RX && millis() - _last_noise_sample >= NOISE_SAMPLE_MILLIS) {
+    _last_noise_sample = millis();
+
+    uint8_t events = getRxEventFlags();
+    noteRxEvents(events);
+    if (events == 0) {   // not mid-packet, sample the noise
+      _noise.addSample(getCurrentRSSI());
+      if (_noise.isValid()) {
+        _noise_floor = _noise.getQuantile(50);
       }
     }
-  } else if (_num_floor_samples >= NUM_NOISE_FLOOR_SAMPLES && _floor_sample_sum != 0) {
-    _noise_floor = _floor_sample_sum / NUM_NOISE_FLOOR_SAMPLES;
-    if (_noise_floor < -120) {
-      _noise_floor = -120;    // clamp to lower bound of -120dBi
-    }
-    _floor_sample_sum = 0;
-
-    MESH_DEBUG_PRINTLN("RadioLibWrapper: noise_floor = %d", (int)_noise_floor);
   }
 }
 
+void RadioLibWrapper::noteRxEvents(uint8_t events) {
+  uint8_t fresh = events & ~_rx_events;   // count each event once per RX session
+  if (fresh & RX_EVENT_PREAMBLE) n_preamble++;
+  if (fresh & RX_EVENT_HEADER) n_header++;
+  _rx_events |= events;
+}
+
 void RadioLibWrapper::startRecv() {
+  _rx_events = 0;
   int err = _radio->startReceive();
   if (err == RADIOLIB_ERR_NONE) {
     state = STATE_RX;
+    if (_tx_done_micros != 0) {   // first Rx after a TX, measure TX done IRQ -> RX
+      _turnaround_us = micros() - _tx_done_micros;
+      if (_turnaround_us > _max_turnaround_us) _max_turnaround_us = _turnaround_us;
+      _tx_done_micros = 0;
+    }
   } else {
     MESH_DEBUG_PRINTLN("RadioLibWrapper: error: startReceive(%d)", err);
   }
@@ -95,41 +122,95 @@ bool RadioLibWrapper::isInRecvMode() const {
   return (state & ~STATE_INT_READY) == STATE_RX;
 }
 
+bool RadioLibWrapper::isRecvPending() {
+  return (state & STATE_INT_READY) != 0 || isReceivingPacket();
+}
+
 int RadioLibWrapper::recvRaw(uint8_t* bytes, int sz) {
   int len = 0;
   if (state & STATE_INT_READY) {
+    uint32_t rx_micros = irq_micros;
+    noteRxEvents(RX_EVENT_PREAMBLE | RX_EVENT_HEADER);   // packet (or header error) implies both
     len = _radio->getPacketLength();
     if (len > 0) {
       if (len > sz) { len = sz; }
-      int err = _radio->readData(bytes, len);
-      if (err != RADIOLIB_ERR_NONE) {
+      int err = _radio->readData(bytes, len);   // NOTE: RadioLib still reads the payload on CRC error
+      bool crc_ok = true;
+      if (err == RADIOLIB_ERR_CRC_MISMATCH) {
+        n_crc_err++;
+        crc_ok = false;
+        if (!_promiscuous) len = 0;
+      } else if (err != RADIOLIB_ERR_NONE) {
         MESH_DEBUG_PRINTLN("RadioLibWrapper: error: readData(%d)", err);
         len = 0;
       } else {
       //  Serial.print("  readData() -> "); Serial.println(len);
         n_recv++;
       }
+
+      if (len > 0) {
+        readRxMeta(_last_meta);   // before startReceive() below
+        _last_meta.rx_micros = rx_micros;
+        _last_meta.len = len;
+        _last_meta.crc_ok = crc_ok;
+      }
     }
     state = STATE_IDLE;   // need another startReceive()
   }
 
   if (state != STATE_RX) {
-    int err = _radio->startReceive();
-    if (err == RADIOLIB_ERR_NONE) {
-      state = STATE_RX;
-    } else {
-      MESH_DEBUG_PRINTLN("RadioLibWrapper: error: startReceive(%d)", err);
-    }
+    startRecv();
   }
   return len;
 }
 
+// LoRa time on air (Semtech SX126x datasheet 6.1.4)
+uint32_t RadioLibWrapper::getLoRaAirtimeMicros(const RadioParams& params, int len_bytes) {
+  int sf = params.sf;
+  float symbol_us = (float)(1 << sf) * 1000.0f / params.bw;
+  bool implicit = (params.lora_flags & LORA_FLAG_IMPLICIT_HDR) != 0;
+  bool crc = (params.lora_flags & LORA_FLAG_NO_CRC) == 0;
+  bool ldro;
+  if (params.lora_flags & LORA_FLAG_LDRO_ON) ldro = true;
+  else if (params.lora_flags & LORA_FLAG_LDRO_OFF) ldro = false;
+  else ldro = symbol_us >= 16000.0f;
+
+  if (implicit) len_bytes = params.implicit_len;   // frames are always padded to this
+  int bits = 8*len_bytes - 4*sf + (crc ? 16 : 0) + (implicit ? 0 : 20) + (sf < 7 ? 0 : 8);
+  int per_block = 4*(sf - (ldro ? 2 : 0));
+  int blocks = bits > 0 ? (bits + per_block - 1) / per_block : 0;
+  float symbols = getLoRaPreamble(params) + (sf < 7 ? 6.25f : 4.25f) + 8 + blocks * params.cr;
+  return (uint32_t) (symbols * symbol_us);
+}
+
 uint32_t RadioLibWrapper::getEstAirtimeFor(int len_bytes) {
-  return _radio->getTimeOnAir(len_bytes) / 1000;
+  if (!_params_valid) return _radio->getTimeOnAir(len_bytes) / 1000;
+  return getEstAirtimeFor(len_bytes, _params);
+}
+
+uint32_t RadioLibWrapper::getEstAirtimeFor(int len_bytes, const RadioParams& params) const {
+  if (params.modem == RADIO_MODEM_FSK) {   // preamble + sync word + length byte + payload + CRC-16
+    uint32_t bits = FSK_PREAMBLE_BITS + (2 + 1 + len_bytes + 2) * 8;
+    return (uint32_t) (bits / params.bitrate) + 1;   // kbps == bits per ms
+  }
+  return (getLoRaAirtimeMicros(params, len_bytes) + 999) / 1000;
 }
 
 bool RadioLibWrapper::startSendRaw(const uint8_t* bytes, int len) {
+  uint8_t padded[256];
+  if (!isFSK() && _params_valid && (_params.lora_flags & LORA_FLAG_IMPLICIT_HDR)) {   // fixed length frames
+    if (len > _params.implicit_len) {
+      MESH_DEBUG_PRINTLN("RadioLibWrapper: error: packet len %d > implicit len %d", len, (uint32_t) _params.implicit_len);
+      return false;
+    }
+    memcpy(padded, bytes, len);
+    memset(&padded[len], 0, _params.implicit_len - len);
+    bytes = padded;
+    len = _params.implicit_len;
+  }
+
   _board->onBeforeTransmit();
+  _tx_done_micros = 0;
   int err = _radio->startTransmit((uint8_t *) bytes, len);
   if (err == RADIOLIB_ERR_NONE) {
     state = STATE_TX_WAIT;
@@ -142,6 +223,7 @@ bool RadioLibWrapper::startSendRaw(const uint8_t* bytes, int len) {
 
 bool RadioLibWrapper::isSendComplete() {
   if (state & STATE_INT_READY) {
+    _tx_done_micros = irq_micros;
     state = STATE_IDLE;
     n_sent++;
     return true;
@@ -149,10 +231,14 @@ bool RadioLibWrapper::isSendComplete() {
   return false;
 }
 
-void RadioLibWrapper::onSendFinished() {
+void RadioLibWrapper::onSendFinished(bool rearm) {
   _radio->finishTransmit();
   _board->onAfterTransmit();
+  afterTransmit();
+
+  // re-arm RX right away, rather than waiting for the next recvRaw(), so a quick reply isn't missed
   state = STATE_IDLE;
+  if (rearm) startRecv();
 }
 
 bool RadioLibWrapper::isChannelActive() {
@@ -161,11 +247,135 @@ bool RadioLibWrapper::isChannelActive() {
           : getCurrentRSSI() > _noise_floor + _threshold;
 }
 
-float RadioLibWrapper::getLastRSSI() const {
-  return _radio->getRSSI();
+int RadioLibWrapper::surveyRSSI(float start_freq, float step, int num_bins, int samples, SurveyBin bins[]) {
+  // make sure we're not mid-receive of packet, or have one waiting for recvRaw()
+  if ((state & STATE_INT_READY) != 0 || isReceivingPacket()) return 0;
+
+  int8_t rssi[SURVEY_MAX_SAMPLES];
+  samples = constrain(samples, 1, SURVEY_MAX_SAMPLES);
+
+  int n;
+  for (n = 0; n < num_bins; n++) {
+    if (state & STATE_INT_READY) break;   // a packet came in on the last bin, stop here so it isn't lost
+    idle();
+    if (_radio->setFrequency(start_freq + step*n) != RADIOLIB_ERR_NONE) break;   // out of radio's range
+    startRecv();
+    delayMicroseconds(SURVEY_SETTLE_MICROS);
+
+    int sum = 0;
+    for (int i = 0; i < samples; i++) {
+      if (i > 0) delayMicroseconds(SURVEY_SAMPLE_MICROS);
+      int8_t v = (int8_t) constrain((int)getCurrentRSSI(), -128, 127);
+      sum += v;
+
+      int j = i;   // insertion sort, for percentiles
+      while (j > 0 && rssi[j - 1] > v) { rssi[j] = rssi[j - 1]; j--; }
+      rssi[j] = v;
+    }
+    bins[n].min = rssi[0];
+    bins[n].p50 = rssi[samples / 2];
+    bins[n].avg = sum / samples;
+    bins[n].p90 = rssi[(samples * 9) / 10];
+    bins[n].max = rssi[samples - 1];
+  }
+
+  // back to active channel
+  bool pending = (state & STATE_INT_READY) != 0;
+  _radio->standby();
+  if (_params_valid) _radio->setFrequency(_params.freq);
+  if (pending) {
+    state = STATE_IDLE | STATE_INT_READY;   // still in the radio's buffer, for recvRaw() (which then restarts RX)
+  } else {
+    state = STATE_IDLE;
+    startRecv();
+  }
+  return n;
+}
+
+bool RadioLibWrapper::isChannelBusyCAD() {
+  if (isReceivingPacket() || (state & STATE_INT_READY) != 0) return true;
+
+  bool busy;
+  int16_t res = isFSK() ? RADIOLIB_ERR_WRONG_MODEM : performCAD();   // no CAD for FSK, RSSI only
+  _cad_err = !isFSK() && res != RADIOLIB_LORA_DETECTED && res != RADIOLIB_CHANNEL_FREE;
+  if (res == RADIOLIB_LORA_DETECTED) {
+    busy = true;
+  } else if (res == RADIOLIB_CHANNEL_FREE) {
+    busy = false;
+  } else {   // CAD failed, fall back to RSSI
+    MESH_DEBUG_PRINTLN("RadioLibWrapper: error: scanChannel(%d)", res);
+    int limit = _threshold > 0 ? _noise_floor + _threshold : _noise.getQuantile(90) + LBT_RSSI_FALLBACK_MARGIN;
+    busy = _noise.isValid() && getCurrentRSSI() > limit;
+  }
+
+  // CAD done also fires our DIO interrupt, and leaves radio in standby
+  state = STATE_IDLE;
+  startRecv();
+  return busy;
 }
-float RadioLibWrapper::getLastSNR() const {
-  return _radio->getSNR();
+
+// CAD settings per SF (7..12), from Semtech AN1200.48 (for 125kHz, also fine for wider BW)
+static const uint8_t cad_params[][3] = {
+  // symbols, det_peak, det_min
+  { 2, 22, 10 },   // SF7
+  { 2, 22, 10 },   // SF8
+  { 4, 23, 10 },   // SF9
+  { 4, 24, 10 },   // SF10
+  { 4, 25, 10 },   // SF11
+  { 4, 28, 10 },   // SF12
+};
+
+void RadioLibWrapper::getCADParams(uint8_t sf, uint8_t& sym_num, uint8_t& det_peak, uint8_t& det_min) {
+  int i = constrain((int)sf, 7, 12) - 7;
+  sym_num = cad_params[i][0];
+  det_peak = cad_params[i][1];
+  det_min = cad_params[i][2];
+}
+
+int16_t RadioLibWrapper::scanSX126xChannel(SX126x* radio) {
+  uint8_t sym_num, det_peak, det_min;
+  getCADParams(radio->spreadingFactor, sym_num, det_peak, det_min);
+
+  ChannelScanConfig_t config;
+  config.cad.symNum = sym_num >= 4 ? RADIOLIB_SX126X_CAD_ON_4_SYMB : RADIOLIB_SX126X_CAD_ON_2_SYMB;
+  config.cad.detPeak = det_peak;
+  config.cad.detMin = det_min;
+  config.cad.exitMode = RADIOLIB_SX126X_CAD_GOTO_STDBY;
+  config.cad.timeout = 0;
+  config.cad.irqFlags = RADIOLIB_IRQ_CAD_DEFAULT_FLAGS;
+  config.cad.irqMask = RADIOLIB_IRQ_CAD_DEFAULT_MASK;
+  return radio->scanChannel(config);
+}
+
+void RadioLibWrapper::readRxMeta(mesh::RxMetadata& meta) {
+  if (isFSK()) {
+    readFSKRxMeta(meta);
+    return;
+  }
+  meta.rssi = meta.signal_rssi = _radio->getRSSI();
+  meta.snr = _radio->getSNR();
+  meta.freq_error = 0;
+}
+
+void RadioLibWrapper::readFSKRxMeta(mesh::RxMetadata& meta) {
+  // FSK radios report no SNR, so estimate it from the channel's noise floor
+  meta.rssi = meta.signal_rssi = _radio->getRSSI();
+  meta.snr = _noise.isValid() ? meta.rssi - _noise.getQuantile(50) : 0;
+  meta.freq_error = 0;
+}
+
+int16_t RadioLibWrapper::switchSX126xModem(SX126x* radio, uint8_t modem) {
+  // same packet type setup as RadioLib's begin() / beginFSK(), without the chip reset
+  return radio->config(modem == RADIO_MODEM_FSK ? RADIOLIB_SX126X_PACKET_TYPE_GFSK : RADIOLIB_SX126X_PACKET_TYPE_LORA);
+}
+
+void RadioLibWrapper::readSX126xRxMeta(SX126x* radio, mesh::RxMetadata& meta) {
+  // one GetPacketStatus command, decoded the same way as RadioLib's getRSSI() / getSNR()
+  uint32_t status = radio->getPacketStatus();
+  meta.rssi = -((float)(status & 0xFF)) / 2.0f;
+  meta.snr = ((float)(int8_t)((status >> 8) & 0xFF)) / 4.0f;
+  meta.signal_rssi = -((float)((status >> 16) & 0xFF)) / 2.0f;
+  meta.freq_error = radio->getFrequencyError();   // single burst register read
 }
 
 // Approximate SNR threshold per SF for successful reception (based on Semtech datasheets)
@@ -179,11 +389,16 @@ static float snr_threshold[] = {
 };
   
 float RadioLibWrapper::packetScoreInt(float snr, int sf, int packet_len) {
-  if (sf < 7) return 0.0f;
-  
-  if (snr < snr_threshold[sf - 7]) return 0.0f;    // Below threshold, no chance of success
+  if (sf != 0 && sf < 7) return 0.0f;
+
+  if (_noise.isValid()) {
+    snr -= _noise.getQuantile(90) - _noise.getQuantile(50);   // margin for bursty noise/interference on this channel
+  }
+
+  float threshold = sf == 0 ? FSK_SNR_THRESHOLD : snr_threshold[sf - 7];   // sf = 0 for FSK
+  if (snr < threshold) return 0.0f;    // Below threshold, no chance of success
 
-  auto success_rate_based_on_snr = (snr - snr_threshold[sf - 7]) / 10.0;
+  auto success_rate_based_on_snr = (snr - threshold) / 10.0;
   auto collision_penalty = 1 - (packet_len / 256.0);   // Assuming max packet of 256 bytes
 
   return max(0.0, min(1.0, success_rate_based_on_snr * collision_penalty));
@@ -2,32 +2,244 @@
 
 #include <Mesh.h>
 #include <RadioLib.h>
+#include <helpers/NoiseFloorEstimator.h>
+
+#define RADIO_MODEM_LORA   0
+#define RADIO_MODEM_FSK    1    // GFSK, BT 0.5, variable length packets, CRC-16
+
+#ifndef FSK_PREAMBLE_BITS
+  #define FSK_PREAMBLE_BITS  32
+#endif
+#ifndef FSK_SYNC_WORD_HI
+  #define FSK_SYNC_WORD_HI   0x2D    // FSK sync word is 2 bytes: [FSK_SYNC_WORD_HI][sync_word]
+#endif
+#ifndef FSK_SNR_THRESHOLD
+  #define FSK_SNR_THRESHOLD  10.0f   // dB above noise floor, for packetScore()
+#endif
+
+#ifndef LORA_DEFAULT_PREAMBLE
+  #define LORA_DEFAULT_PREAMBLE  16
+#endif
+
+// RadioParams::lora_flags, all clear is the default LoRa setup
+#define LORA_FLAG_IMPLICIT_HDR   0x01    // fixed length frames of 'implicit_len', no header
+#define LORA_FLAG_NO_CRC         0x02
+#define LORA_FLAG_INVERT_IQ      0x04
+#define LORA_FLAG_LDRO_ON        0x08    // low data rate optimisation forced on,
+#define LORA_FLAG_LDRO_OFF       0x10    //  or off. (neither = auto, on when symbol time >= 16ms)
+
+struct RadioParams {
+  float freq;
+  float bw;          // LoRa bandwidth, or FSK receiver bandwidth (kHz)
+  uint8_t sf;        // LoRa only
+  uint8_t cr;        // LoRa only
+  uint8_t sync_word;
+  uint8_t modem;     // RADIO_MODEM_*
+  float bitrate;     // FSK only (kbps)
+  float freq_dev;    // FSK only (kHz)
+  uint16_t preamble_len;   // LoRa only, symbols. 0 = LORA_DEFAULT_PREAMBLE
+  uint8_t lora_flags;      // LoRa only, LORA_FLAG_*
+  uint8_t implicit_len;    // LoRa only, with LORA_FLAG_IMPLICIT_HDR
+};
+
+#ifndef SURVEY_MAX_SAMPLES
+  #define SURVEY_MAX_SAMPLES  64
+#endif
+
+#define RX_EVENT_PREAMBLE   0x01
+#define RX_EVENT_HEADER     0x02
+
+struct SurveyBin {   // dBm
+  int8_t min;
+  int8_t p50;
+  int8_t avg;
+  int8_t p90;
+  int8_t max;
+};
 
 class RadioLibWrapper : public mesh::Radio {
 protected:
   PhysicalLayer* _radio;
   mesh::MainBoard* _board;
   uint32_t n_recv, n_sent;
+  uint32_t n_preamble, n_header, n_crc_err;
+  uint8_t _rx_events;   // RX_EVENT_* seen since last startRecv()
+  bool _promiscuous;
   int16_t _noise_floor, _threshold;
-  uint16_t _num_floor_samples;
-  int32_t _floor_sample_sum;
+  NoiseFloorEstimator _noise;
+  unsigned long _last_noise_sample;
+  mesh::RxMetadata _last_meta;
+  uint32_t _tx_done_micros;
+  uint32_t _turnaround_us, _max_turnaround_us;
+  RadioParams _params;
+  bool _params_valid;
+  uint32_t _reconfig_us;
+  int16_t _reconfig_err;
+  bool _cad_err;
 
   void idle();
   void startRecv();
   float packetScoreInt(float snr, int sf, int packet_len);
+  static void readSX126xRxMeta(SX126x* radio, mesh::RxMetadata& meta);
+  void readFSKRxMeta(mesh::RxMetadata& meta);
+  bool isFSK() const { return _params_valid && _params.modem == RADIO_MODEM_FSK; }
+  static uint16_t getLoRaPreamble(const RadioParams& params) { return params.preamble_len ? params.preamble_len : LORA_DEFAULT_PREAMBLE; }
+  static uint32_t getLoRaAirtimeMicros(const RadioParams& params, int len_bytes);
+  static int16_t switchSX126xModem(SX126x* radio, uint8_t modem);
+  static void getCADParams(uint8_t sf, uint8_t& sym_num, uint8_t& det_peak, uint8_t& det_min);
+  static int16_t scanSX126xChannel(SX126x* radio);
+
+  /**
+   * \brief  runs a (blocking) CAD on the current channel.
+   * \returns  RADIOLIB_LORA_DETECTED, RADIOLIB_CHANNEL_FREE, or an error code
+  */
+  virtual int16_t performCAD() { return _radio->scanChannel(); }
+
+  /**
+   * \brief  switches the chip's packet type (RADIO_MODEM_*), in place. Called from reconfigure(), in standby,
+   *         after which all modulation and packet params are re-sent.
+  */
+  virtual int16_t switchModem(uint8_t modem) { return modem == RADIO_MODEM_LORA ? RADIOLIB_ERR_NONE : RADIOLIB_ERR_UNSUPPORTED; }
+
+  /**
+   * \brief  reads the status of the packet just received. Called before RX is restarted, so the
+   *         radio's packet status still belongs to this packet.
+  */
+  virtual void readRxMeta(mesh::RxMetadata& meta);
+
+  /**
+   * \brief  chip specific fix-ups after a transmit, called just before RX is re-armed.
+  */
+  virtual void afterTransmit() { }
   virtual bool isReceivingPacket() =0;
 
+  /**
+   * \returns  RX_EVENT_* bits for the current RX session (latched IRQ flags where the chip has them)
+  */
+  virtual uint8_t getRxEventFlags() { return isReceivingPacket() ? RX_EVENT_PREAMBLE : 0; }
+  void noteRxEvents(uint8_t events);
+  void checkReconfig(int16_t err) { if (_reconfig_err == RADIOLIB_ERR_NONE) _reconfig_err = err; }
+
 public:
-  RadioLibWrapper(PhysicalLayer& radio, mesh::MainBoard& board) : _radio(&radio), _board(&board) { n_recv = n_sent = 0; }
+  RadioLibWrapper(PhysicalLayer& radio, mesh::MainBoard& board) : _radio(&radio), _board(&board) {
+    n_recv = n_sent = 0;
+    n_preamble = n_header = n_crc_err = 0;
+    _rx_events = 0;
+    _cad_err = false;
+    _promiscuous = false;
+    memset(&_last_meta, 0, sizeof(_last_meta));
+    _tx_done_micros = _turnaround_us = _max_turnaround_us = 0;
+    _params_valid = false;
+    _reconfig_us = 0;
+    _reconfig_err = RADIOLIB_ERR_NONE;
+  }
+
+  /**
+   * \brief  applies only the params which differ from the active ones, all in one standby window,
+   *         then goes straight back to RX.
+   * \param  radio  the RadioLib chip object (same as passed to constructor)
+   * \returns  true if anything was changed
+  */
+  template<class R>
+  bool reconfigure(R& radio, const RadioParams& params) {
+    _reconfig_err = RADIOLIB_ERR_NONE;
+    bool modem = !_params_valid || params.modem != _params.modem;
+    bool all = modem;   // new packet type, so send everything
+    bool freq = all || params.freq != _params.freq;
+    bool bw = all || params.bw != _params.bw;
+    bool sync_word = all || params.sync_word != _params.sync_word;
+    bool fsk = params.modem == RADIO_MODEM_FSK;
+    bool sf = !fsk && (all || params.sf != _params.sf);
+    bool cr = !fsk && (all || params.cr != _params.cr);
+    bool bitrate = fsk && (all || params.bitrate != _params.bitrate);
+    bool freq_dev = fsk && (all || params.freq_dev != _params.freq_dev);
+    uint8_t flags_diff = all ? 0xFF : params.lora_flags ^ _params.lora_flags;
+    bool preamble = !fsk && (all || params.preamble_len != _params.preamble_len);
+    bool header = !fsk && ((flags_diff & LORA_FLAG_IMPLICIT_HDR) || params.implicit_len != _params.implicit_len);
+    bool crc = !fsk && (flags_diff & LORA_FLAG_NO_CRC);
+    bool iq = !fsk && (flags_diff & LORA_FLAG_INVERT_IQ);
+    bool ldro = !fsk && (flags_diff & (LORA_FLAG_LDRO_ON | LORA_FLAG_LDRO_OFF));
+    if (!(freq || bw || sf || cr || sync_word || bitrate || freq_dev || preamble || header || crc || iq || ldro)) return false;   // nothing to do
+
+    uint32_t start = micros();
+    idle();
+    if (modem) {
+      checkReconfig(switchModem(params.modem));
+      if (fsk) {
+        checkReconfig(radio.setPreambleLength(FSK_PREAMBLE_BITS));
+        checkReconfig(radio.setDataShaping(RADIOLIB_SHAPING_0_5));
+        checkReconfig(radio.variablePacketLengthMode(255));
+        checkReconfig(radio.setCRC(2));
+      }
+    }
+    if (freq) {
+      checkReconfig(radio.setFrequency(params.freq));
+      _noise.setChannel(params.freq);
+      if (_noise.isValid()) _noise_floor = _noise.getQuantile(50);
+    }
+    if (fsk) {
+      if (bitrate) checkReconfig(radio.setBitRate(params.bitrate));
+      if (freq_dev) checkReconfig(radio.setFrequencyDeviation(params.freq_dev));
+      if (bw) checkReconfig(radio.setRxBandwidth(params.bw));
+      if (sync_word) {
+        uint8_t sw[2] = { FSK_SYNC_WORD_HI, params.sync_word };
+        checkReconfig(radio.setSyncWord(sw, sizeof(sw)));
+      }
+    } else {
+      if (sf) checkReconfig(radio.setSpreadingFactor(params.sf));
+      if (bw) checkReconfig(radio.setBandwidth(params.bw));
+      if (cr) checkReconfig(radio.setCodingRate(params.cr));
+      if (sync_word) checkReconfig(radio.setSyncWord(params.sync_word));
+      if (preamble) checkReconfig(radio.setPreambleLength(getLoRaPreamble(params)));
+      if (header) {
+        bool implicit = (params.lora_flags & LORA_FLAG_IMPLICIT_HDR) != 0;
+        checkReconfig(implicit ? radio.implicitHeader(params.implicit_len) : radio.explicitHeader());
+      }
+      if (crc) checkReconfig(radio.setCRC((params.lora_flags & LORA_FLAG_NO_CRC) ? 0 : 1));
+      if (iq) checkReconfig(radio.invertIQ((params.lora_flags & LORA_FLAG_INVERT_IQ) != 0));
+      if (ldro) {   // NOTE: after sf/bw, which re-calc LDRO while it is auto
+        if (params.lora_flags & LORA_FLAG_LDRO_ON) checkReconfig(radio.forceLDRO(true));
+        else if (params.lora_flags & LORA_FLAG_LDRO_OFF) checkReconfig(radio.forceLDRO(false));
+        else checkReconfig(radio.autoLDRO());
+      }
+    }
+    startRecv();
+    _reconfig_us = micros() - start;
+
+    _params = params;
+    _params_valid = true;
+    MESH_DEBUG_PRINTLN("RadioLibWrapper: reconfigured in %u us (err=%d)", _reconfig_us, (int32_t) _reconfig_err);
+    return true;
+  }
+  const RadioParams& getParams() const { return _params; }
+
+  /**
+   * \returns  first RadioLib error from the last reconfigure(), eg. an FSK rx bandwidth the chip doesn't support
+  */
+  int16_t getReconfigError() const { return _reconfig_err; }
+
+  /**
+   * \brief  sweeps from 'start_freq' in 'step' increments (MHz), taking 'samples' instantaneous RSSI readings
+   *         per step, then returns to the active frequency.  NOTE: blocking
+   *         Refused while a packet is being received or waiting to be read, and ends early if one comes in
+   *         on a bin, so it is kept for recvRaw().
+   * \returns  number of bins filled
+  */
+  int surveyRSSI(float start_freq, float step, int num_bins, int samples, SurveyBin bins[]);
+  uint32_t getReconfigMicros() const override { return _reconfig_us; }
 
   void begin() override;
   int recvRaw(uint8_t* bytes, int sz) override;
   uint32_t getEstAirtimeFor(int len_bytes) override;
+  uint32_t getEstAirtimeFor(int len_bytes, const RadioParams& params) const;   // for params other than the active ones
   bool startSendRaw(const uint8_t* bytes, int len) override;
   bool isSendComplete() override;
-  void onSendFinished() override;
+  void onSendFinished(bool rearm) override;
   bool isInRecvMode() const override;
+  bool isRecvPending() override;
   bool isChannelActive();
+  bool isChannelBusyCAD() override;
+  bool isCADFaulty() const override { return _cad_err; }
 
   bool isReceiving() override { 
     if (isReceivingPacket()) return true;
@@ -38,6 +250,7 @@ public:
   virtual float getCurrentRSSI() =0;
 
   int getNoiseFloor() const override { return _noise_floor; }
+  const NoiseFloorEstimator& getNoiseEstimator() const { return _noise; }
   void triggerNoiseFloorCalibrate(int threshold) override;
   void resetAGC() override;
 
@@ -45,12 +258,38 @@ public:
 
   uint32_t getPacketsRecv() const { return n_recv; }
   uint32_t getPacketsSent() const { return n_sent; }
-  void resetStats() { n_recv = n_sent = 0; }
+  uint32_t getPreambleCount() const { return n_preamble; }
+  uint32_t getHeaderCount() const { return n_header; }
+  uint32_t getCRCErrorCount() const { return n_crc_err; }
+  void resetStats() {
+    n_recv = n_sent = 0;
+    n_preamble = n_header = n_crc_err = 0;
+    _turnaround_us = _max_turnaround_us = 0;
+  }
+
+  /**
+   * \brief  standby, then back into receive. (first step of radio recovery)
+  */
+  void rearm();
+
+  /**
+   * \brief  call after the chip has been re-initialised (eg. radio_init()). The next reconfigure() sends all params.
+  */
+  void onRadioReset();
+
+  /**
+   * \brief  when enabled, frames failing CRC are also returned by recvRaw(), with RxMetadata::crc_ok = false
+  */
+  void setPromiscuous(bool enable) { _promiscuous = enable; }
+  bool isPromiscuous() const { return _promiscuous; }
 
-  virtual float getLastRSSI() const override;
-  virtual float getLastSNR() const override;
+  float getLastRSSI() const override { return _last_meta.rssi; }
+  float getLastSNR() const override { return _last_meta.snr; }
+  void getLastRxMeta(mesh::RxMetadata& meta) const override { meta = _last_meta; }
+  uint32_t getTxTurnaroundMicros() const override { return _turnaround_us; }
+  uint32_t getMaxTxTurnaroundMicros() const override { return _max_turnaround_us; }
 
-  float packetScore(float snr, int packet_len) override { return packetScoreInt(snr, 10, packet_len); }  // assume sf=10
+  float packetScore(float snr, int packet_len) override { return packetScoreInt(snr, isFSK() ? 0 : 10, packet_len); }  // assume sf=10
 };
 
 /**
@@ -19,12 +19,8 @@ uint32_t radio_get_rng_seed() {
   return radio.random(0x7FFFFFFF);
 }
 
-void radio_set_params(float freq, float bw, uint8_t sf, uint8_t cr, uint8_t syncWord) { 
-  radio.setFrequency(freq);
-  radio.setSpreadingFactor(sf);
-  radio.setBandwidth(bw);
-  radio.setCodingRate(cr);
-  radio.setSyncWord(syncWord);
+void radio_set_params(const RadioParams& params) {
+  radio_driver.reconfigure(radio, params);
 }
 
 void radio_set_tx_power(uint8_t dbm) {
@@ -13,5 +13,5 @@ extern VolatileRTCClock rtc_clock;
 
 bool radio_init();
 uint32_t radio_get_rng_seed();
-void radio_set_params(float freq, float bw, uint8_t sf, uint8_t cr, uint8_t syncWord);
+void radio_set_params(const RadioParams& params);
 void radio_set_tx_power(uint8_t dbm);